@@ -0,0 +1,196 @@
+#pragma once
+
+#include "cellLocator.hpp"
+#include "gridCache.hpp"
+#include "parallel.hpp"
+
+#include <fantom/dataset.hpp>
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace tasks
+{
+    using namespace fantom;
+
+    namespace cells
+    {
+        // local vertex indices of the faces of each volume cell, unused slots are -1.
+        // Prisms follow the VTK order with 3, 4, 5 above 0, 1, 2.
+        typedef std::array<int, 4> Face;
+
+        inline const std::vector<Face> &faces(Cell::Type type) {
+            static const std::vector<Face> none;
+            static const std::vector<Face> tetrahedron = {{{0, 1, 2, -1}}, {{0, 1, 3, -1}}, {{1, 2, 3, -1}}, {{0, 2, 3, -1}}};
+            static const std::vector<Face> pyramid = {{{0, 1, 2, 3}}, {{0, 1, 4, -1}}, {{1, 2, 4, -1}}, {{2, 3, 4, -1}}, {{3, 0, 4, -1}}};
+            static const std::vector<Face> prism = {{{0, 1, 2, -1}}, {{3, 4, 5, -1}}, {{0, 1, 4, 3}}, {{1, 2, 5, 4}}, {{2, 0, 3, 5}}};
+            static const std::vector<Face> hexahedron = {{{0, 1, 2, 3}}, {{4, 5, 6, 7}}, {{0, 1, 6, 7}},
+                                                         {{1, 2, 5, 6}}, {{2, 3, 4, 5}}, {{3, 0, 7, 4}}};
+            switch (type) {
+            case Cell::Type::TETRAHEDRON: return tetrahedron;
+            case Cell::Type::PYRAMID: return pyramid;
+            case Cell::Type::PRISM: return prism;
+            case Cell::Type::HEXAHEDRON: return hexahedron;
+            default: return none;
+            }
+        }
+    }
+
+    // face neighbours of every cell in CSR layout: the faces of cell c are
+    // first[c] .. first[c + 1] in the order of cells::faces, neighbour holds the
+    // cell on the other side or boundary
+    class CellAdjacency
+    {
+    public:
+        enum : std::uint32_t { boundary = UINT32_MAX };
+
+        std::vector<std::uint32_t> first;
+        std::vector<std::uint32_t> neighbour;
+
+        // returns the adjacency of the grid, builds it only on first use
+        static std::shared_ptr<const CellAdjacency> forGrid(std::shared_ptr<const Grid<3>> grid, std::string *log = nullptr) {
+            bool built;
+            double seconds = 0.0;
+            auto adjacency = cachedForGrid<CellAdjacency>(grid, [&]() {
+                auto start = std::chrono::steady_clock::now();
+                std::shared_ptr<const CellAdjacency> adjacency(new CellAdjacency(*grid));
+                seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                return adjacency;
+            }, built);
+            if (log && built) {
+                std::ostringstream s;
+                s << "cell adjacency: " << adjacency->neighbour.size() << " faces, "
+                  << adjacency->numBoundaryFaces() << " on the boundary, built in " << seconds * 1000 << " ms, "
+                  << adjacency->bytes() / 1024 << " KiB";
+                *log = s.str();
+            }
+            return adjacency;
+        }
+
+        size_t bytes() const {
+            return (first.size() + neighbour.size()) * sizeof(std::uint32_t);
+        }
+
+        size_t numBoundaryFaces() const {
+            size_t n = 0;
+            for (std::uint32_t c : neighbour) {
+                if (c == boundary) n++;
+            }
+            return n;
+        }
+
+        // walks from cell start towards p, always through the face p lies
+        // furthest outside of. Returns false if the walk leaves the grid through
+        // a boundary face or does not arrive within maxSteps cells.
+        bool walk(const Grid<3> &grid, const Point3 &p, size_t start, CellLocation &loc, size_t maxSteps = 16) const {
+            const ValueArray<Point3> &points = grid.points();
+            size_t c = start;
+            for (size_t step = 0; step < maxSteps; step++) {
+                if (cells::contains(grid, c, p, loc)) return true;
+                Cell cell = grid.cell(c);
+                const std::vector<cells::Face> &faces = cells::faces(cell.type());
+                Point3 center;
+                for (size_t j = 0; j < cell.numVertices(); j++) {
+                    center += points[cell.index(j)];
+                }
+                center = center / (double) cell.numVertices();
+                double furthest = 0.0;
+                size_t exit = faces.size();
+                for (size_t f = 0; f < faces.size(); f++) {
+                    Point3 a = points[cell.index(faces[f][0])];
+                    Vector3 e1 = points[cell.index(faces[f][1])] - a;
+                    Vector3 e2 = points[cell.index(faces[f][2])] - a;
+                    Vector3 n(e1[1] * e2[2] - e1[2] * e2[1],
+                              e1[2] * e2[0] - e1[0] * e2[2],
+                              e1[0] * e2[1] - e1[1] * e2[0]);
+                    double length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+                    if (length == 0.0) continue;
+                    double inside = n[0] * (center[0] - a[0]) + n[1] * (center[1] - a[1]) + n[2] * (center[2] - a[2]);
+                    double d = (n[0] * (p[0] - a[0]) + n[1] * (p[1] - a[1]) + n[2] * (p[2] - a[2])) / length;
+                    if (inside > 0) d = -d;
+                    if (d > furthest) {
+                        furthest = d;
+                        exit = f;
+                    }
+                }
+                if (exit == faces.size()) return false;
+                std::uint32_t next = neighbour[first[c] + exit];
+                if (next == boundary) return false;
+                c = next;
+            }
+            return false;
+        }
+
+    private:
+        // a face as its sorted vertex indices, ordered by hash first so that most
+        // comparisons during the sort are a single integer compare
+        struct FaceKey
+        {
+            std::uint64_t hash;
+            std::array<std::uint32_t, 4> vertices;
+            std::uint32_t slot;
+
+            bool operator<(const FaceKey &o) const {
+                if (hash != o.hash) return hash < o.hash;
+                return vertices < o.vertices;
+            }
+        };
+
+        CellAdjacency(const Grid<3> &grid) {
+            size_t nCells = grid.numCells();
+            first.resize(nCells + 1);
+            first[0] = 0;
+            for (size_t c = 0; c < nCells; c++) {
+                first[c + 1] = first[c] + (std::uint32_t) cells::faces(grid.cell(c).type()).size();
+            }
+            neighbour.assign(first[nCells], boundary);
+            std::vector<std::uint32_t> owner(first[nCells]);
+
+            // every face of every cell with its sorted key
+            std::vector<FaceKey> keys(first[nCells]);
+            parallelFor(0, nCells, [&](size_t b, size_t e, size_t) {
+                for (size_t c = b; c < e; c++) {
+                    Cell cell = grid.cell(c);
+                    const std::vector<cells::Face> &faces = cells::faces(cell.type());
+                    for (size_t f = 0; f < faces.size(); f++) {
+                        FaceKey &key = keys[first[c] + f];
+                        for (size_t j = 0; j < 4; j++) {
+                            key.vertices[j] = faces[f][j] >= 0 ? (std::uint32_t) cell.index(faces[f][j]) : UINT32_MAX;
+                        }
+                        std::sort(key.vertices.begin(), key.vertices.end());
+                        std::uint64_t h = 1469598103934665603ull;
+                        for (std::uint32_t v : key.vertices) {
+                            h = (h ^ v) * 1099511628211ull;
+                        }
+                        key.hash = h;
+                        key.slot = first[c] + (std::uint32_t) f;
+                        owner[first[c] + f] = (std::uint32_t) c;
+                    }
+                }
+            });
+
+            // equal faces end up next to each other, the two cells sharing one
+            // become neighbours. A face shared by more cells is non-manifold and
+            // treated as boundary.
+            parallelSort(keys, [](const FaceKey &a, const FaceKey &b) { return a < b; });
+            parallelFor(0, keys.size(), [&](size_t b, size_t e, size_t) {
+                // each block starts at the beginning of a run of equal keys
+                while (b > 0 && b < e && keys[b].hash == keys[b - 1].hash && keys[b].vertices == keys[b - 1].vertices) b++;
+                for (size_t i = b; i < e;) {
+                    size_t j = i + 1;
+                    while (j < keys.size() && keys[j].hash == keys[i].hash && keys[j].vertices == keys[i].vertices) j++;
+                    if (j - i == 2) {
+                        neighbour[keys[i].slot] = owner[keys[i + 1].slot];
+                        neighbour[keys[i + 1].slot] = owner[keys[i].slot];
+                    }
+                    i = j;
+                }
+            });
+        }
+    };
+}
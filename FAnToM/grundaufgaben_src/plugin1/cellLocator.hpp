@@ -0,0 +1,389 @@
+#pragma once
+
+#include "gridCache.hpp"
+#include "parallel.hpp"
+
+#include <fantom/dataset.hpp>
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace tasks
+{
+    using namespace fantom;
+
+    // where a point lies inside a cell: the cell and the interpolation
+    // weights of its vertices
+    struct CellLocation
+    {
+        size_t cell;
+        size_t part = 0;    // the tet of a split pyramid or prism
+        size_t count;
+        size_t nodes[8];
+        double weights[8];
+    };
+
+    // ---------------------------------------------------------------------------
+    // point in cell tests with interpolation weights
+    // ---------------------------------------------------------------------------
+
+    namespace cells
+    {
+        const double eps = 1e-9;
+
+        // solves a * x = b with Cramer's rule, false if a is singular
+        inline bool solve3(const double a[3][3], const double b[3], double x[3]) {
+            double det = a[0][0] * (a[1][1] * a[2][2] - a[1][2] * a[2][1])
+                       - a[0][1] * (a[1][0] * a[2][2] - a[1][2] * a[2][0])
+                       + a[0][2] * (a[1][0] * a[2][1] - a[1][1] * a[2][0]);
+            if (std::abs(det) < 1e-300) return false;
+            for (size_t c = 0; c < 3; c++) {
+                double m[3][3];
+                for (size_t r = 0; r < 3; r++) {
+                    for (size_t k = 0; k < 3; k++) {
+                        m[r][k] = k == c ? b[r] : a[r][k];
+                    }
+                }
+                x[c] = (m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+                      - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+                      + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0])) / det;
+            }
+            return true;
+        }
+
+        // barycentric coordinates of p in the tetrahedron t0..t3
+        inline bool tetrahedron(const Point3 &p, const Point3 *t[4], double w[4]) {
+            double a[3][3], b[3], x[3];
+            for (size_t r = 0; r < 3; r++) {
+                for (size_t c = 0; c < 3; c++) {
+                    a[r][c] = (*t[c + 1])[r] - (*t[0])[r];
+                }
+                b[r] = p[r] - (*t[0])[r];
+            }
+            if (!solve3(a, b, x)) return false;
+            w[0] = 1.0 - x[0] - x[1] - x[2];
+            w[1] = x[0];
+            w[2] = x[1];
+            w[3] = x[2];
+            return w[0] >= -eps && w[1] >= -eps && w[2] >= -eps && w[3] >= -eps;
+        }
+
+        // local coordinates of the FAnToM hexahedron vertices: 0-3 is the bottom
+        // face, 4 lies above 3, 5 above 2, 6 above 1 and 7 above 0
+        const double hexCorner[8][3] = {{0, 0, 0}, {1, 0, 0}, {1, 1, 0}, {0, 1, 0},
+                                        {0, 1, 1}, {1, 1, 1}, {1, 0, 1}, {0, 0, 1}};
+
+        inline void hexWeights(const double u[3], double w[8]) {
+            for (size_t j = 0; j < 8; j++) {
+                w[j] = (hexCorner[j][0] ? u[0] : 1 - u[0])
+                     * (hexCorner[j][1] ? u[1] : 1 - u[1])
+                     * (hexCorner[j][2] ? u[2] : 1 - u[2]);
+            }
+        }
+
+        // inverts the trilinear map with a few newton steps
+        inline bool hexahedron(const Point3 &p, const Point3 *h[8], double w[8]) {
+            double u[3] = {0.5, 0.5, 0.5};
+            for (size_t it = 0; it < 12; it++) {
+                double f[3] = {-p[0], -p[1], -p[2]};
+                double jac[3][3] = {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
+                for (size_t j = 0; j < 8; j++) {
+                    double s[3], ds[3];
+                    for (size_t d = 0; d < 3; d++) {
+                        s[d] = hexCorner[j][d] ? u[d] : 1 - u[d];
+                        ds[d] = hexCorner[j][d] ? 1 : -1;
+                    }
+                    double n = s[0] * s[1] * s[2];
+                    double dn[3] = {ds[0] * s[1] * s[2], s[0] * ds[1] * s[2], s[0] * s[1] * ds[2]};
+                    for (size_t r = 0; r < 3; r++) {
+                        f[r] += n * (*h[j])[r];
+                        for (size_t c = 0; c < 3; c++) {
+                            jac[r][c] += dn[c] * (*h[j])[r];
+                        }
+                    }
+                }
+                double du[3];
+                if (!solve3(jac, f, du)) return false;
+                u[0] -= du[0];
+                u[1] -= du[1];
+                u[2] -= du[2];
+                if (std::abs(du[0]) + std::abs(du[1]) + std::abs(du[2]) < 1e-12) break;
+            }
+            for (size_t d = 0; d < 3; d++) {
+                if (!(u[d] >= -eps && u[d] <= 1 + eps)) return false;
+            }
+            hexWeights(u, w);
+            return true;
+        }
+
+        // pyramids and prisms are split into tetrahedra and interpolated linearly
+        const size_t pyramidTets[2][4] = {{0, 1, 2, 4}, {0, 2, 3, 4}};
+        const size_t prismTets[3][4] = {{0, 1, 2, 5}, {0, 1, 5, 4}, {0, 4, 5, 3}};
+
+        inline bool splitCell(const Point3 &p, const Cell &cell, const ValueArray<Point3> &points,
+                              const size_t (*tets)[4], size_t nTets, CellLocation &loc) {
+            for (size_t t = 0; t < nTets; t++) {
+                const Point3 *corners[4];
+                for (size_t j = 0; j < 4; j++) {
+                    corners[j] = &points[cell.index(tets[t][j])];
+                }
+                double w[4];
+                if (tetrahedron(p, corners, w)) {
+                    loc.part = t;
+                    loc.count = 4;
+                    for (size_t j = 0; j < 4; j++) {
+                        loc.nodes[j] = cell.index(tets[t][j]);
+                        loc.weights[j] = w[j];
+                    }
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        inline bool contains(const Grid<3> &grid, size_t c, const Point3 &p, CellLocation &loc) {
+            const ValueArray<Point3> &points = grid.points();
+            Cell cell = grid.cell(c);
+            loc.cell = c;
+            loc.part = 0;
+            switch (cell.type()) {
+            case Cell::Type::TETRAHEDRON: {
+                const Point3 *corners[4];
+                for (size_t j = 0; j < 4; j++) {
+                    corners[j] = &points[cell.index(j)];
+                    loc.nodes[j] = cell.index(j);
+                }
+                loc.count = 4;
+                return tetrahedron(p, corners, loc.weights);
+            }
+            case Cell::Type::HEXAHEDRON: {
+                const Point3 *corners[8];
+                for (size_t j = 0; j < 8; j++) {
+                    corners[j] = &points[cell.index(j)];
+                    loc.nodes[j] = cell.index(j);
+                }
+                loc.count = 8;
+                return hexahedron(p, corners, loc.weights);
+            }
+            case Cell::Type::PYRAMID:
+                return splitCell(p, cell, points, pyramidTets, 2, loc);
+            case Cell::Type::PRISM:
+                return splitCell(p, cell, points, prismTets, 3, loc);
+            default:
+                // lines and surface cells do not contain volume
+                return false;
+            }
+        }
+    }
+
+    // ---------------------------------------------------------------------------
+    // bounding volume hierarchy over the cell bounds
+    // ---------------------------------------------------------------------------
+
+    class CellLocator
+    {
+    public:
+        // returns the locator of the grid, builds it only on first use
+        static std::shared_ptr<const CellLocator> forGrid(std::shared_ptr<const Grid<3>> grid, std::string *log = nullptr) {
+            bool built;
+            double seconds = 0.0;
+            auto locator = cachedForGrid<CellLocator>(grid, [&]() {
+                auto start = std::chrono::steady_clock::now();
+                std::shared_ptr<const CellLocator> locator(new CellLocator(*grid));
+                seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                return locator;
+            }, built);
+            if (log && !built) {
+                *log = "cell locator: reused for " + std::to_string(grid->numCells()) + " cells";
+            } else if (log) {
+                std::ostringstream s;
+                s << "cell locator: built bvh over " << grid->numCells() << " cells with "
+                  << locator->nodes.size() << " nodes in " << seconds * 1000 << " ms, "
+                  << locator->bytes() / 1024 << " KiB";
+                *log = s.str();
+            }
+            return locator;
+        }
+
+        // grid is the one the locator was built for, the locator does not keep
+        // it, so a cached locator cannot outlive it. hint is a cell tried
+        // before the tree is searched, usually the last hit.
+        bool locate(const Grid<3> &grid, const Point3 &p, CellLocation &loc, size_t hint = SIZE_MAX) const {
+            if (hint < grid.numCells() && cells::contains(grid, hint, p, loc)) return true;
+            if (nodes.empty()) return false;
+            float q[3] = {(float) p[0], (float) p[1], (float) p[2]};
+            // a depth first search holds at most one node per level and its sibling
+            std::uint32_t local[64];
+            std::vector<std::uint32_t> deep;
+            std::uint32_t *stack = local;
+            if (depth + 2 > 64) {
+                deep.resize(depth + 2);
+                stack = deep.data();
+            }
+            size_t top = 0;
+            stack[top++] = 0;
+            while (top) {
+                const Node &node = nodes[stack[--top]];
+                if (!node.contains(q)) continue;
+                if (node.count) {
+                    for (std::uint32_t i = node.first; i < node.first + node.count; i++) {
+                        if (bounds[i].contains(q) && cells::contains(grid, order[i], p, loc)) return true;
+                    }
+                } else {
+                    stack[top++] = node.first;
+                    stack[top++] = node.first + 1;
+                }
+            }
+            return false;
+        }
+
+        size_t bytes() const {
+            return nodes.size() * sizeof(Node) + bounds.size() * sizeof(Box) + order.size() * sizeof(std::uint32_t);
+        }
+
+    private:
+        struct Box
+        {
+            float lo[3];
+            float hi[3];
+
+            bool contains(const float q[3]) const {
+                return q[0] >= lo[0] && q[0] <= hi[0]
+                    && q[1] >= lo[1] && q[1] <= hi[1]
+                    && q[2] >= lo[2] && q[2] <= hi[2];
+            }
+
+            void extend(const Box &b) {
+                for (size_t d = 0; d < 3; d++) {
+                    lo[d] = std::min(lo[d], b.lo[d]);
+                    hi[d] = std::max(hi[d], b.hi[d]);
+                }
+            }
+        };
+
+        // leaves hold count > 0 cells starting at first, inner nodes have their
+        // two children at first and first + 1
+        struct Node : Box
+        {
+            std::uint32_t first;
+            std::uint32_t count;
+        };
+
+        static const size_t leafSize = 4;
+
+        std::vector<Node> nodes;
+        std::vector<Box> bounds;            // cell bounds in tree order
+        std::vector<std::uint32_t> order;   // cell index in tree order
+        size_t depth = 0;                   // levels below the root
+
+        // spreads the lower 10 bits so that three of them can be interleaved
+        static std::uint32_t spread(std::uint32_t x) {
+            x = (x | (x << 16)) & 0x030000ff;
+            x = (x | (x << 8)) & 0x0300f00f;
+            x = (x | (x << 4)) & 0x030c30c3;
+            x = (x | (x << 2)) & 0x09249249;
+            return x;
+        }
+
+        // linear bvh: cells sorted along the morton curve of their centers,
+        // the tree splits at the highest differing bit
+        CellLocator(const Grid<3> &grid)
+        {
+            const ValueArray<Point3> &points = grid.points();
+            size_t nCells = grid.numCells();
+            std::vector<Box> cellBounds(nCells);
+            parallelFor(0, nCells, [&](size_t b, size_t e, size_t) {
+                for (size_t c = b; c < e; c++) {
+                    Cell cell = grid.cell(c);
+                    Box &box = cellBounds[c];
+                    for (size_t d = 0; d < 3; d++) {
+                        box.lo[d] = INFINITY;
+                        box.hi[d] = -INFINITY;
+                    }
+                    for (size_t j = 0; j < cell.numVertices(); j++) {
+                        Point3 p = points[cell.index(j)];
+                        for (size_t d = 0; d < 3; d++) {
+                            box.lo[d] = std::min(box.lo[d], std::nextafter((float) p[d], -INFINITY));
+                            box.hi[d] = std::max(box.hi[d], std::nextafter((float) p[d], INFINITY));
+                        }
+                    }
+                }
+            });
+            if (nCells == 0) return;
+
+            Box scene = cellBounds[0];
+            for (size_t c = 1; c < nCells; c++) {
+                scene.extend(cellBounds[c]);
+            }
+            std::vector<std::pair<std::uint32_t, std::uint32_t>> keys(nCells);
+            parallelFor(0, nCells, [&](size_t b, size_t e, size_t) {
+                for (size_t c = b; c < e; c++) {
+                    std::uint32_t code = 0;
+                    for (size_t d = 0; d < 3; d++) {
+                        float extent = std::max(scene.hi[d] - scene.lo[d], 1e-30f);
+                        float center = 0.5f * (cellBounds[c].lo[d] + cellBounds[c].hi[d]);
+                        float x = std::min(std::max((center - scene.lo[d]) / extent, 0.0f), 1.0f);
+                        code |= spread((std::uint32_t) (x * 1023.0f)) << d;
+                    }
+                    keys[c] = std::make_pair(code, (std::uint32_t) c);
+                }
+            });
+            parallelSort(keys, [](const std::pair<std::uint32_t, std::uint32_t> &a,
+                                  const std::pair<std::uint32_t, std::uint32_t> &b) { return a < b; });
+
+            order.resize(nCells);
+            bounds.resize(nCells);
+            for (size_t i = 0; i < nCells; i++) {
+                order[i] = keys[i].second;
+                bounds[i] = cellBounds[order[i]];
+            }
+            nodes.reserve(2 * nCells / leafSize + 1);
+            nodes.emplace_back();
+            emit(0, keys, 0, nCells, 0);
+        }
+
+        void emit(size_t index, const std::vector<std::pair<std::uint32_t, std::uint32_t>> &keys,
+                  size_t begin, size_t end, size_t level) {
+            depth = std::max(depth, level);
+            if (end - begin <= leafSize) {
+                Node &leaf = nodes[index];
+                static_cast<Box &>(leaf) = bounds[begin];
+                for (size_t i = begin + 1; i < end; i++) {
+                    leaf.extend(bounds[i]);
+                }
+                leaf.first = (std::uint32_t) begin;
+                leaf.count = (std::uint32_t) (end - begin);
+                return;
+            }
+            std::uint32_t a = keys[begin].first;
+            std::uint32_t b = keys[end - 1].first;
+            size_t split = (begin + end) / 2;
+            if (a != b) {
+                // first key that has the highest differing bit set
+                std::uint32_t bit = 1u << (31 - __builtin_clz(a ^ b));
+                size_t lo = begin, hi = end - 1;
+                while (lo < hi) {
+                    size_t mid = (lo + hi) / 2;
+                    if (keys[mid].first & bit) hi = mid;
+                    else lo = mid + 1;
+                }
+                split = lo;
+            }
+            size_t children = nodes.size();
+            nodes.emplace_back();
+            nodes.emplace_back();
+            nodes[index].first = (std::uint32_t) children;
+            nodes[index].count = 0;
+            emit(children, keys, begin, split, level + 1);
+            emit(children + 1, keys, split, end, level + 1);
+            Box box = nodes[children];
+            box.extend(nodes[children + 1]);
+            static_cast<Box &>(nodes[index]) = box;
+        }
+    };
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include "seedGenerators.hpp"
+#include "spatialHash.hpp"
+#include "velocitySampler.hpp"
+
+#include <fantom/dataset.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace tasks
+{
+    using namespace fantom;
+
+    // Evenly spaced streamlines after Jobard and Lefer, in 3D. New seeds are
+    // taken at distance dSep around the samples of the lines emitted so far,
+    // perpendicular to the line, and only where no other line is within dSep.
+    // A line being traced stops once it comes closer than dTest to another one.
+    // The user seeds are drawn to start over whenever the front runs dry, so
+    // regions that are not connected to the first line get lines as well.
+    class EvenSeeder
+    {
+    public:
+        EvenSeeder(double dSep, double dTest, std::unique_ptr<SeedGenerator> userSeeds)
+            : dSep(dSep), dTest(std::min(dTest, dSep)), hash(dSep), userSeeds(std::move(userSeeds)),
+              lines(0), sample(0), direction(0), candidates(0), rejected(0)
+        {
+        }
+
+        // stop criterion for the tracer, the current line is not in the hash yet
+        bool accept(const Point3 &p) const {
+            return !hash.near(p, dTest);
+        }
+
+        // samples of every traced line have to be added before the next seed is
+        // asked for. They are only kept in the hash, the caller owns the line.
+        void addLine(const std::vector<Point3> &points) {
+            for (const Point3 &p : points) {
+                hash.insert(p, lines);
+            }
+            lines++;
+        }
+
+        bool next(VelocitySampler &sampler, Point3 &seed) {
+            // around the samples of the lines emitted so far, in the order they were emitted
+            for (; sample + 1 < hash.size(); sample++, direction = 0) {
+                if (hash.line(sample + 1) != hash.line(sample)) continue;
+                const Point3 &p = hash.point(sample);
+                Vector3 a, b;
+                if (!perpendicular(hash.point(sample + 1) - p, a, b)) continue;
+                while (direction < 4) {
+                    Vector3 offset = direction == 0 ? a : direction == 1 ? -a : direction == 2 ? b : -b;
+                    direction++;
+                    if (free(sampler, p + dSep * offset)) {
+                        seed = p + dSep * offset;
+                        return true;
+                    }
+                }
+            }
+            // front ran dry, start over at the next free user seed
+            Point3 p;
+            while (userSeeds->next(p)) {
+                if (free(sampler, p)) {
+                    seed = p;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        std::string describe() const {
+            std::ostringstream s;
+            s << "evenly spaced seeding: " << lines << " lines, " << hash.size() << " samples, "
+              << candidates << " candidate seeds of which " << rejected << " were too close or outside";
+            return s.str();
+        }
+
+    private:
+        // two unit vectors perpendicular to t and to each other
+        static bool perpendicular(const Vector3 &t, Vector3 &a, Vector3 &b) {
+            double length = std::sqrt(t[0] * t[0] + t[1] * t[1] + t[2] * t[2]);
+            if (!(length > 0.0)) return false;
+            Vector3 n = t / length;
+            Vector3 axis = std::abs(n[0]) < 0.9 ? Vector3(1.0, 0.0, 0.0) : Vector3(0.0, 1.0, 0.0);
+            a = Vector3(n[1] * axis[2] - n[2] * axis[1], n[2] * axis[0] - n[0] * axis[2], n[0] * axis[1] - n[1] * axis[0]);
+            a = a / std::sqrt(a[0] * a[0] + a[1] * a[1] + a[2] * a[2]);
+            b = Vector3(n[1] * a[2] - n[2] * a[1], n[2] * a[0] - n[0] * a[2], n[0] * a[1] - n[1] * a[0]);
+            return true;
+        }
+
+        bool free(VelocitySampler &sampler, const Point3 &p) {
+            candidates++;
+            if (hash.near(p, dSep) || !sampler.reset(p)) {
+                rejected++;
+                return false;
+            }
+            Vector3 v = sampler.value();
+            if (v[0] == 0 && v[1] == 0 && v[2] == 0) {
+                rejected++;
+                return false;
+            }
+            return true;
+        }
+
+        double dSep;
+        double dTest;
+        SpatialHash hash;
+        std::unique_ptr<SeedGenerator> userSeeds;
+        size_t lines, sample, direction;
+        size_t candidates, rejected;
+    };
+}
@@ -0,0 +1,569 @@
+#pragma once
+
+#include "cellAdjacency.hpp"
+#include "cellLocator.hpp"
+#include "velocitySampler.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace tasks
+{
+    using namespace fantom;
+
+    // ---------------------------------------------------------------------------
+    // fp16 conversion (IEEE 754 binary16, round to nearest)
+    // ---------------------------------------------------------------------------
+
+    inline std::uint16_t floatToHalf(float value) {
+        std::uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        std::uint16_t sign = (bits >> 16) & 0x8000;
+        int exponent = int((bits >> 23) & 0xff) - 127 + 15;
+        std::uint32_t mantissa = bits & 0x7fffff;
+        if (((bits >> 23) & 0xff) == 0xff) {
+            // inf stays inf, nan stays nan
+            return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+        }
+        if (exponent >= 31) return sign | 0x7c00;
+        if (exponent <= 0) {
+            // too small for a normal half, make it subnormal or zero
+            if (exponent < -10) return sign;
+            mantissa |= 0x800000;
+            int shift = 14 - exponent;
+            std::uint32_t half = mantissa >> shift;
+            if ((mantissa >> (shift - 1)) & 1) half++;
+            return sign | half;
+        }
+        std::uint32_t half = (exponent << 10) | (mantissa >> 13);
+        // a carry out of the mantissa correctly bumps the exponent
+        if (mantissa & 0x1000) half++;
+        return sign | half;
+    }
+
+    inline float halfToFloat(std::uint16_t half) {
+        std::uint32_t sign = std::uint32_t(half & 0x8000) << 16;
+        std::uint32_t exponent = (half >> 10) & 0x1f;
+        std::uint32_t mantissa = half & 0x3ff;
+        std::uint32_t bits;
+        if (exponent == 0) {
+            float f = std::ldexp((float) mantissa, -24);
+            return sign ? -f : f;
+        } else if (exponent == 31) {
+            bits = sign | 0x7f800000 | (mantissa << 13);
+        } else {
+            bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+        }
+        float f;
+        std::memcpy(&f, &bits, sizeof(f));
+        return f;
+    }
+
+    // ---------------------------------------------------------------------------
+    // node value stores, all with the same get(i) so the interpolation can be
+    // instantiated for each of them and the decompression gets inlined
+    // ---------------------------------------------------------------------------
+
+    struct HalfNodes
+    {
+        // three halfs per node, interleaved
+        std::vector<std::uint16_t> values;
+
+        // from the values of a Function or any other array of them
+        template <typename Values>
+        explicit HalfNodes(const Values &input) {
+            values.resize(3 * input.size());
+            for (size_t i = 0; i < input.size(); i++) {
+                Vector3 v = input[i];
+                for (size_t c = 0; c < 3; c++) {
+                    values[3 * i + c] = floatToHalf((float) v[c]);
+                }
+            }
+        }
+
+        Vector3 get(size_t i) const {
+            const std::uint16_t *h = &values[3 * i];
+            return Vector3(halfToFloat(h[0]), halfToFloat(h[1]), halfToFloat(h[2]));
+        }
+
+        size_t bytes() const {
+            return values.size() * sizeof(std::uint16_t);
+        }
+    };
+
+    struct QuantizedNodes
+    {
+        // bricks of consecutive nodes share one offset and scale per component,
+        // every component is stored as 16 bit integer inside that range
+        static const size_t brickSize = 256;
+
+        std::vector<std::uint16_t> values;
+        std::vector<float> offset;
+        std::vector<float> scale;
+
+        // from the values of a Function or any other array of them
+        template <typename Values>
+        explicit QuantizedNodes(const Values &input) {
+            size_t nBricks = (input.size() + brickSize - 1) / brickSize;
+            values.resize(3 * input.size());
+            offset.resize(3 * nBricks);
+            scale.resize(3 * nBricks);
+            for (size_t b = 0; b < nBricks; b++) {
+                size_t begin = b * brickSize;
+                size_t end = std::min(input.size(), begin + brickSize);
+                for (size_t c = 0; c < 3; c++) {
+                    double lo = INFINITY, hi = -INFINITY;
+                    for (size_t i = begin; i < end; i++) {
+                        lo = std::min(lo, input[i][c]);
+                        hi = std::max(hi, input[i][c]);
+                    }
+                    offset[3 * b + c] = (float) lo;
+                    scale[3 * b + c] = (float) ((hi - lo) / 65535.0);
+                    for (size_t i = begin; i < end; i++) {
+                        double q = hi > lo ? (input[i][c] - lo) / (hi - lo) * 65535.0 : 0.0;
+                        values[3 * i + c] = (std::uint16_t) std::lround(q);
+                    }
+                }
+            }
+        }
+
+        Vector3 get(size_t i) const {
+            size_t b = 3 * (i / brickSize);
+            const std::uint16_t *q = &values[3 * i];
+            return Vector3(offset[b] + scale[b] * q[0],
+                           offset[b + 1] + scale[b + 1] * q[1],
+                           offset[b + 2] + scale[b + 2] * q[2]);
+        }
+
+        size_t bytes() const {
+            return values.size() * sizeof(std::uint16_t)
+                 + (offset.size() + scale.size()) * sizeof(float);
+        }
+    };
+
+    // ---------------------------------------------------------------------------
+    // uniform lattice with x running fastest, like DomainFactory::makeUniformGrid
+    // ---------------------------------------------------------------------------
+
+    struct Lattice
+    {
+        size_t n[3];
+        double origin[3];
+        double spacing[3];
+
+        // recognizes a uniform grid from its points and cell count, so it works
+        // for whatever the loader handed us
+        static bool detect(const Grid<3> &grid, Lattice &lattice) {
+            const ValueArray<Point3> &points = grid.points();
+            if (points.size() < 8) return false;
+            Point3 p0 = points[0];
+            size_t stride[3] = {1, 0, 0};
+            for (size_t d = 0; d < 3; d++) {
+                lattice.origin[d] = p0[d];
+            }
+            // the second axis starts where the first one wraps, the third where the second one does
+            size_t nx = 1;
+            while (nx < points.size() && points[nx][1] == p0[1] && points[nx][2] == p0[2]) nx++;
+            size_t ny = 1;
+            while (ny * nx < points.size() && points[ny * nx][2] == p0[2]) ny++;
+            if (nx < 2 || ny < 2 || points.size() % (nx * ny) != 0) return false;
+            size_t nz = points.size() / (nx * ny);
+            if (nz < 2) return false;
+            // the same points may also carry tetrahedra or other cells
+            if (grid.numCells() != (nx - 1) * (ny - 1) * (nz - 1)
+                || grid.cell(0).type() != Cell::Type::HEXAHEDRON) return false;
+            lattice.n[0] = nx;
+            lattice.n[1] = ny;
+            lattice.n[2] = nz;
+            stride[1] = nx;
+            stride[2] = nx * ny;
+            for (size_t d = 0; d < 3; d++) {
+                lattice.spacing[d] = points[stride[d]][d] - p0[d];
+                if (!(lattice.spacing[d] > 0)) return false;
+            }
+            for (size_t k = 0; k < nz; k++) {
+                for (size_t j = 0; j < ny; j++) {
+                    for (size_t i = 0; i < nx; i++) {
+                        Point3 p = points[i + nx * (j + ny * k)];
+                        size_t ijk[3] = {i, j, k};
+                        for (size_t d = 0; d < 3; d++) {
+                            if (std::abs(p[d] - (p0[d] + ijk[d] * lattice.spacing[d])) > 1e-6 * lattice.spacing[d]) {
+                                return false;
+                            }
+                        }
+                    }
+                }
+            }
+            return true;
+        }
+
+        size_t numCells() const {
+            return (n[0] - 1) * (n[1] - 1) * (n[2] - 1);
+        }
+
+        // the eight nodes around p with their trilinear weights, loc.cell is the
+        // index of the lowest node
+        bool locate(const Point3 &p, CellLocation &loc) const {
+            size_t c[3];
+            double t[3];
+            for (size_t d = 0; d < 3; d++) {
+                double x = (p[d] - origin[d]) / spacing[d];
+                if (!(x >= 0.0 && x <= n[d] - 1)) return false;
+                c[d] = std::min((size_t) x, n[d] - 2);
+                t[d] = x - c[d];
+            }
+            size_t sy = n[0];
+            size_t sz = n[0] * n[1];
+            loc.cell = c[0] + sy * c[1] + sz * c[2];
+            loc.count = 8;
+            for (size_t j = 0; j < 8; j++) {
+                size_t dx = j & 1, dy = (j >> 1) & 1, dz = j >> 2;
+                loc.nodes[j] = loc.cell + dx + sy * dy + sz * dz;
+                loc.weights[j] = (dx ? t[0] : 1.0 - t[0]) * (dy ? t[1] : 1.0 - t[1]) * (dz ? t[2] : 1.0 - t[2]);
+            }
+            return true;
+        }
+    };
+
+    // trilinear interpolation on the lattice, reading nodes from any store
+    template <typename Nodes>
+    class LatticeSampler : public VelocitySampler
+    {
+    public:
+        LatticeSampler(const Lattice &lattice, std::shared_ptr<const Nodes> nodes,
+                       std::unique_ptr<SampleCache> cache = nullptr)
+            : lattice(lattice), nodes(std::move(nodes)), cache(std::move(cache))
+        {
+        }
+
+        bool reset(const Point<3> &p) override {
+            size_t c[3];
+            double t[3];
+            for (size_t d = 0; d < 3; d++) {
+                double x = (p[d] - lattice.origin[d]) / lattice.spacing[d];
+                // the negated test also rejects nan
+                if (!(x >= 0.0 && x <= lattice.n[d] - 1)) return false;
+                c[d] = std::min((size_t) x, lattice.n[d] - 2);
+                t[d] = x - c[d];
+            }
+            size_t sy = lattice.n[0];
+            size_t sz = lattice.n[0] * lattice.n[1];
+            size_t base = c[0] + sy * c[1] + sz * c[2];
+            if (cache && cache->find(base, t, v)) return true;
+            const Nodes &n = *nodes;
+            Vector3 x00 = n.get(base)                + t[0] * (n.get(base + 1) - n.get(base));
+            Vector3 x10 = n.get(base + sy)           + t[0] * (n.get(base + sy + 1) - n.get(base + sy));
+            Vector3 x01 = n.get(base + sz)           + t[0] * (n.get(base + sz + 1) - n.get(base + sz));
+            Vector3 x11 = n.get(base + sy + sz)      + t[0] * (n.get(base + sy + sz + 1) - n.get(base + sy + sz));
+            Vector3 y0 = x00 + t[1] * (x10 - x00);
+            Vector3 y1 = x01 + t[1] * (x11 - x01);
+            v = y0 + t[2] * (y1 - y0);
+            if (cache) cache->store(base, t, v);
+            return true;
+        }
+
+        Vector3 value() const override {
+            return v;
+        }
+
+    private:
+        Lattice lattice;
+        std::shared_ptr<const Nodes> nodes;
+        std::unique_ptr<SampleCache> cache;
+        Vector3 v;
+    };
+
+    // interpolation inside the cells found by the locator, for any grid.
+    // Consecutive samples are mostly close, so the search first walks the
+    // neighbours of the last cell and only falls back to the tree.
+    template <typename Nodes>
+    class CellSampler : public VelocitySampler
+    {
+    public:
+        CellSampler(std::shared_ptr<const Grid<3>> grid,
+                    std::shared_ptr<const CellLocator> locator,
+                    std::shared_ptr<const CellAdjacency> adjacency,
+                    std::shared_ptr<const Nodes> nodes,
+                    std::unique_ptr<SampleCache> cache = nullptr)
+            : grid(std::move(grid)), locator(std::move(locator)), adjacency(std::move(adjacency)),
+              nodes(std::move(nodes)), cache(std::move(cache)), last(SIZE_MAX)
+        {
+        }
+
+        bool reset(const Point<3> &p) override {
+            CellLocation loc;
+            bool found = last != SIZE_MAX && adjacency->walk(*grid, p, last, loc);
+            if (!found && !locator->locate(*grid, p, loc)) return false;
+            last = loc.cell;
+            // the first three weights determine the position inside the cell, or
+            // inside one tet of it for pyramids and prisms, which get a key each
+            size_t key = loc.cell * 3 + loc.part;
+            if (cache && cache->find(key, loc.weights, v)) return true;
+            v = loc.weights[0] * nodes->get(loc.nodes[0]);
+            for (size_t j = 1; j < loc.count; j++) {
+                v += loc.weights[j] * nodes->get(loc.nodes[j]);
+            }
+            if (cache) cache->store(key, loc.weights, v);
+            return true;
+        }
+
+        Vector3 value() const override {
+            return v;
+        }
+
+    private:
+        std::shared_ptr<const Grid<3>> grid;
+        std::shared_ptr<const CellLocator> locator;
+        std::shared_ptr<const CellAdjacency> adjacency;
+        std::shared_ptr<const Nodes> nodes;
+        std::unique_ptr<SampleCache> cache;
+        size_t last;
+        Vector3 v;
+    };
+
+    // ---------------------------------------------------------------------------
+    // the velocity field as the tracers see it
+    // ---------------------------------------------------------------------------
+
+    struct StorageError
+    {
+        size_t samples = 0;
+        double maxError = 0.0;
+        double rmsError = 0.0;
+        double maxSpeed = 0.0;
+        size_t timed = 0;                // samples timed, found or not
+        double ownSeconds = 0.0;         // locating and interpolating them
+        double referenceSeconds = 0.0;   // the same with the input field's evaluator
+    };
+
+    class FieldStorage
+    {
+    public:
+        enum class Type { Double, Half, Quantized };
+
+        static std::vector<std::string> choices() {
+            return {"Double", "Half", "Quantized"};
+        }
+
+        FieldStorage(std::shared_ptr<const Field<3, Vector3>> field,
+                     std::shared_ptr<const Function<Vector3>> function,
+                     const std::string &storage)
+            : field(std::move(field)), type(Type::Double), onLattice(false), nodeBytes(0)
+        {
+            if (storage == "Half") type = Type::Half;
+            else if (storage == "Quantized") type = Type::Quantized;
+            if (!function) {
+                refuse("needs node values");
+                return;
+            }
+
+            // own interpolation needs node data, anything else keeps using the
+            // evaluator of the input field
+            grid = std::dynamic_pointer_cast<const Grid<3>>(function->domain());
+            if (!grid || function->values().size() != grid->numPoints()) {
+                refuse("needs the values at the grid points");
+                return;
+            }
+            // uniform lattices are located arithmetically. On everything else
+            // the input's evaluator locates faster than the bvh, which is only
+            // built for the compressed nodes, since the evaluator cannot read them
+            onLattice = Lattice::detect(*grid, lattice);
+            if (!onLattice) {
+                if (type == Type::Double) return;
+                std::string adjacencyLog;
+                cellLocator = CellLocator::forGrid(grid, &locatorLog);
+                adjacency = CellAdjacency::forGrid(grid, &adjacencyLog);
+                if (!adjacencyLog.empty()) locatorLog += "\n" + adjacencyLog;
+            }
+            if (type == Type::Half) {
+                half = std::make_shared<HalfNodes>(function->values());
+                nodeBytes = half->bytes();
+            } else if (type == Type::Quantized) {
+                quantized = std::make_shared<QuantizedNodes>(function->values());
+                nodeBytes = quantized->bytes();
+            } else {
+                input = std::make_shared<InputNodes>(function);
+            }
+            doubleBytes = function->values().size() * sizeof(Vector3);
+        }
+
+        // keeps the last samples of every sampler made from now on, only
+        // possible where the samplers interpolate themselves
+        bool useCache(size_t size, double tolerance) {
+            cacheSize = size;
+            cacheTolerance = tolerance;
+            return !size || onLattice || cellLocator;
+        }
+
+        // one sampler per thread, they all share the nodes and the locator
+        std::unique_ptr<VelocitySampler> makeSampler() const {
+            return makeSampler(cacheSize > 0);
+        }
+
+        bool compressed() const {
+            return type != Type::Double;
+        }
+
+        // true if the samplers interpolate themselves instead of using the field
+        bool ownInterpolation() const {
+            return (onLattice && (compressed() || cacheSize)) || cellLocator;
+        }
+
+        std::string describeCache() const {
+            std::lock_guard<std::mutex> lock(countersMutex);
+            CacheCounters sum;
+            for (const auto &c : counters) {
+                sum.lookups += c->lookups;
+                sum.hits += c->hits;
+            }
+            std::ostringstream s;
+            s << "sample cache: " << sum.hits << " hits in " << sum.lookups << " lookups ("
+              << (sum.lookups ? 100.0 * sum.hits / sum.lookups : 0.0) << "%) over "
+              << counters.size() << " samplers";
+            return s.str();
+        }
+
+        std::string describe() const {
+            std::ostringstream s;
+            if (!compressed()) {
+                s << "velocity storage: input field";
+                if (!refused.empty()) s << ", " << refused;
+            } else {
+                s << "velocity storage: " << (type == Type::Half ? "fp16" : "16 bit quantized");
+                if (onLattice) s << " on " << lattice.n[0] << "x" << lattice.n[1] << "x" << lattice.n[2] << " lattice";
+                s << ", " << nodeBytes / 1024 << " KiB instead of " << doubleBytes / 1024 << " KiB";
+            }
+            if (!locatorLog.empty()) s << "\n" << locatorLog;
+            return s.str();
+        }
+
+        // Compares the own interpolation against the input field at every node
+        // and cell center, and times both over the same samples in the same
+        // order, which shows what the compression costs per lookup.
+        StorageError compare() const {
+            StorageError error;
+            if (!ownInterpolation()) return error;
+            auto reference = field->makeEvaluator();
+            auto sampler = makeSampler(false);
+            std::vector<Point3> samples;
+            const ValueArray<Point3> &points = grid->points();
+            for (size_t i = 0; i < points.size(); i++) {
+                samples.push_back(points[i]);
+            }
+            for (size_t c = 0; c < grid->numCells(); c++) {
+                Cell cell = grid->cell(c);
+                Point3 center;
+                for (size_t j = 0; j < cell.numVertices(); j++) {
+                    center += points[cell.index(j)];
+                }
+                samples.push_back(center / (double) cell.numVertices());
+            }
+            auto time = [&](auto &&reset) {
+                auto start = std::chrono::steady_clock::now();
+                for (const Point3 &p : samples) {
+                    reset(p);
+                }
+                return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            };
+            error.timed = samples.size();
+            error.referenceSeconds = time([&](const Point3 &p) { return reference->reset(p); });
+            error.ownSeconds = time([&](const Point3 &p) { return sampler->reset(p); });
+
+            double sum = 0.0;
+            for (const Point3 &p : samples) {
+                if (!reference->reset(p) || !sampler->reset(p)) continue;
+                Vector3 r = reference->value();
+                Vector3 d = sampler->value() - r;
+                double e = std::sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+                error.maxError = std::max(error.maxError, e);
+                error.maxSpeed = std::max(error.maxSpeed, std::sqrt(r[0] * r[0] + r[1] * r[1] + r[2] * r[2]));
+                sum += e * e;
+                error.samples++;
+            }
+            if (error.samples) error.rmsError = std::sqrt(sum / error.samples);
+            return error;
+        }
+
+        std::string describe(const StorageError &error) const {
+            std::ostringstream s;
+            s << "velocity storage error over " << error.samples << " samples: max " << error.maxError
+              << ", rms " << error.rmsError << " (max speed " << error.maxSpeed << ")";
+            if (!error.timed) return s.str();
+            s << "\nlookups: " << 1e9 * error.ownSeconds / error.timed << " ns per sample with the "
+              << (cellLocator ? "bvh locator" : "lattice") << ", "
+              << 1e9 * error.referenceSeconds / error.timed << " ns with the input field";
+            return s.str();
+        }
+
+    private:
+        // falls back to the input field, saying why if compression was asked for
+        void refuse(const std::string &reason) {
+            if (type != Type::Double) refused = "no " + choices()[(size_t) type] + " storage: " + reason;
+            type = Type::Double;
+        }
+
+        std::unique_ptr<VelocitySampler> makeSampler(bool cached) const {
+            if (half) return makeSampler(half, cached);
+            if (quantized) return makeSampler(quantized, cached);
+            if (cellLocator || (onLattice && cached)) return makeSampler(input, cached);
+            return std::unique_ptr<VelocitySampler>(new FieldSampler(*field));
+        }
+
+        template <typename Nodes>
+        std::unique_ptr<VelocitySampler> makeSampler(std::shared_ptr<const Nodes> nodes, bool cached) const {
+            std::unique_ptr<SampleCache> cache;
+            if (cached) {
+                auto c = std::make_shared<CacheCounters>();
+                std::lock_guard<std::mutex> lock(countersMutex);
+                counters.push_back(c);
+                cache.reset(new SampleCache(cacheSize, cacheTolerance, c));
+            }
+            if (onLattice) {
+                return std::unique_ptr<VelocitySampler>(new LatticeSampler<Nodes>(lattice, nodes, std::move(cache)));
+            }
+            return std::unique_ptr<VelocitySampler>(new CellSampler<Nodes>(grid, cellLocator, adjacency, nodes, std::move(cache)));
+        }
+
+        // uncompressed nodes are read straight from the input
+        struct InputNodes
+        {
+            std::shared_ptr<const Function<Vector3>> function;
+            const ValueArray<Vector3> &values;
+
+            InputNodes(std::shared_ptr<const Function<Vector3>> function)
+                : function(function), values(function->values())
+            {
+            }
+
+            Vector3 get(size_t i) const {
+                return values[i];
+            }
+        };
+
+        std::shared_ptr<const Field<3, Vector3>> field;
+        std::shared_ptr<const Grid<3>> grid;
+        Type type;
+        bool onLattice;
+        Lattice lattice;
+        std::shared_ptr<const CellLocator> cellLocator;
+        std::shared_ptr<const CellAdjacency> adjacency;
+        std::string locatorLog;
+        std::string refused;
+        std::shared_ptr<const InputNodes> input;
+        std::shared_ptr<const HalfNodes> half;
+        std::shared_ptr<const QuantizedNodes> quantized;
+        size_t nodeBytes;
+        size_t doubleBytes = 0;
+        size_t cacheSize = 0;
+        double cacheTolerance = 0.0;
+        mutable std::mutex countersMutex;
+        mutable std::vector<std::shared_ptr<CacheCounters>> counters;
+    };
+}
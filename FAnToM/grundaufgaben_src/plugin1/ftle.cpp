@@ -0,0 +1,268 @@
+#include <fantom/algorithm.hpp>
+#include <fantom/dataset.hpp>
+#include <fantom/register.hpp>
+
+#include "fieldStorage.hpp"
+#include "parallel.hpp"
+
+#include <chrono>
+#include <vector>
+#include <math.h>
+#include <cmath>
+
+using namespace fantom;
+
+namespace
+{
+
+    class FtleTask : public DataAlgorithm
+    {
+
+    public:
+        struct Options : public DataAlgorithm::Options
+        {
+            Options(fantom::Options::Control &control)
+                : DataAlgorithm::Options(control)
+            {
+                add< double >( "ox", "origin of the samples in x-dimension", -4.0 );
+                add< double >( "oy", "origin of the samples in y-dimension", -4.0 );
+                add< double >( "oz", "origin of the samples in z-dimension", -4.0 );
+                addSeparator();
+                add< size_t >( "nx", "samples in x-dimension", 64 );
+                add< size_t >( "ny", "samples in y-dimension", 64 );
+                add< size_t >( "nz", "samples in z-dimension", 64 );
+                addSeparator();
+                add< double >( "dx", "sample distance in x-dimension", 0.125 );
+                add< double >( "dy", "sample distance in y-dimension", 0.125 );
+                add< double >( "dz", "sample distance in z-dimension", 0.125 );
+                addSeparator();
+                add<Field<3, Vector3>>("Field", "3D vector field", definedOn<Grid<3>>(Grid<3>::Points));
+                add<InputChoices>("Method", "calculation method.", std::vector<std::string>{"Euler", "Runge-Kutta"}, "Runge-Kutta");
+                add<double>("dStep", "max step size", 0.05);
+                add<double>("T", "integration time, negative for backward FTLE", 5.0);
+                add<InputChoices>("Storage", "in-memory velocity representation", tasks::FieldStorage::choices(), "Double");
+            }
+        };
+
+        struct DataOutputs : public DataAlgorithm::DataOutputs
+        {
+            DataOutputs(fantom::DataOutputs::Control &control)
+                : DataAlgorithm::DataOutputs(control)
+            {
+                add< const Function< Scalar > >( "FTLE" );
+            }
+        };
+
+        FtleTask(InitData &data)
+            : DataAlgorithm(data)
+        {
+        }
+
+        static const size_t packetSize = 8;
+
+        // advects up to packetSize particles together. The stage arithmetic runs
+        // over all lanes at once so it vectorizes, only the interpolation is done
+        // lane by lane. A particle that leaves the domain or stops keeps the
+        // position of its last complete step.
+        static void tracePacket(tasks::VelocitySampler &sampler, bool rungeKutta, double h, size_t nStep, size_t n,
+                                double *px, double *py, double *pz) {
+            bool alive[packetSize];
+            double kx[4][packetSize] = {}, ky[4][packetSize] = {}, kz[4][packetSize] = {};
+            double sx[packetSize], sy[packetSize], sz[packetSize];
+            for (size_t l = 0; l < packetSize; l++) {
+                alive[l] = l < n;
+            }
+            // velocity of every alive lane at s, lanes without one die
+            auto sample = [&](size_t stage) {
+                bool any = false;
+                for (size_t l = 0; l < n; l++) {
+                    if (!alive[l]) continue;
+                    if (!sampler.reset({sx[l], sy[l], sz[l]})) {
+                        alive[l] = false;
+                        continue;
+                    }
+                    Vector3 v = sampler.value();
+                    kx[stage][l] = v[0];
+                    ky[stage][l] = v[1];
+                    kz[stage][l] = v[2];
+                    any = true;
+                }
+                return any;
+            };
+            for (size_t step = 0; step < nStep; step++) {
+                for (size_t l = 0; l < packetSize; l++) {
+                    sx[l] = px[l];
+                    sy[l] = py[l];
+                    sz[l] = pz[l];
+                }
+                if (!sample(0)) return;
+                for (size_t l = 0; l < n; l++) {
+                    if (kx[0][l] == 0 && ky[0][l] == 0 && kz[0][l] == 0) alive[l] = false;
+                }
+                if (rungeKutta) {
+                    static const double c[3] = {0.5, 0.5, 1.0};
+                    for (size_t stage = 1; stage < 4; stage++) {
+                        for (size_t l = 0; l < packetSize; l++) {
+                            sx[l] = px[l] + c[stage - 1] * h * kx[stage - 1][l];
+                            sy[l] = py[l] + c[stage - 1] * h * ky[stage - 1][l];
+                            sz[l] = pz[l] + c[stage - 1] * h * kz[stage - 1][l];
+                        }
+                        if (!sample(stage)) return;
+                    }
+                    for (size_t l = 0; l < packetSize; l++) {
+                        double mx = (kx[0][l] + 2 * kx[1][l] + 2 * kx[2][l] + kx[3][l]) / 6.0;
+                        double my = (ky[0][l] + 2 * ky[1][l] + 2 * ky[2][l] + ky[3][l]) / 6.0;
+                        double mz = (kz[0][l] + 2 * kz[1][l] + 2 * kz[2][l] + kz[3][l]) / 6.0;
+                        px[l] = alive[l] ? px[l] + h * mx : px[l];
+                        py[l] = alive[l] ? py[l] + h * my : py[l];
+                        pz[l] = alive[l] ? pz[l] + h * mz : pz[l];
+                    }
+                } else {
+                    for (size_t l = 0; l < packetSize; l++) {
+                        px[l] = alive[l] ? px[l] + h * kx[0][l] : px[l];
+                        py[l] = alive[l] ? py[l] + h * ky[0][l] : py[l];
+                        pz[l] = alive[l] ? pz[l] + h * kz[0][l] : pz[l];
+                    }
+                }
+            }
+        }
+
+        // largest eigenvalue of the symmetric matrix c, closed form
+        static double maxEigenvalue(const double c[3][3]) {
+            double p1 = c[0][1] * c[0][1] + c[0][2] * c[0][2] + c[1][2] * c[1][2];
+            double q = (c[0][0] + c[1][1] + c[2][2]) / 3.0;
+            double p2 = (c[0][0] - q) * (c[0][0] - q) + (c[1][1] - q) * (c[1][1] - q)
+                      + (c[2][2] - q) * (c[2][2] - q) + 2.0 * p1;
+            if (p2 <= 0.0) return q;
+            double p = std::sqrt(p2 / 6.0);
+            double b[3][3];
+            for (size_t i = 0; i < 3; i++) {
+                for (size_t j = 0; j < 3; j++) {
+                    b[i][j] = (c[i][j] - (i == j ? q : 0.0)) / p;
+                }
+            }
+            double r = 0.5 * (b[0][0] * (b[1][1] * b[2][2] - b[1][2] * b[2][1])
+                            - b[0][1] * (b[1][0] * b[2][2] - b[1][2] * b[2][0])
+                            + b[0][2] * (b[1][0] * b[2][1] - b[1][1] * b[2][0]));
+            double phi = r <= -1.0 ? M_PI / 3.0 : r >= 1.0 ? 0.0 : std::acos(r) / 3.0;
+            return q + 2.0 * p * std::cos(phi);
+        }
+
+        virtual void execute(const Algorithm::Options &options, const volatile bool &abortFlag) override
+        {
+            double origin[] = { options.get< double >("ox"),
+                                options.get< double >("oy"),
+                                options.get< double >("oz")};
+            size_t extent[] = { options.get< size_t >("nx"),
+                                options.get< size_t >("ny"),
+                                options.get< size_t >("nz")};
+            double spacing[] = {options.get< double >("dx"),
+                                options.get< double >("dy"),
+                                options.get< double >("dz")};
+            bool rungeKutta = options.get<std::string>("Method") == "Runge-Kutta";
+            double dStep = options.get<double>("dStep");
+            double T = options.get<double>("T");
+
+            std::shared_ptr<const Field<3, Vector3>> field = options.get<Field<3, Vector3>>("Field");
+            std::shared_ptr<const Function<Vector3>> function = options.get<Function<Vector3>>("Field");
+
+            // if there is no input, do nothing
+            if (!field) {
+                debugLog() << "Input Field not set." << std::endl;
+                return;
+            }
+            if (extent[0] * extent[1] * extent[2] == 0 || T == 0.0 || !(dStep > 0.0)) {
+                debugLog() << "Nothing to integrate." << std::endl;
+                return;
+            }
+
+            tasks::FieldStorage storage(field, function,
+                                        options.get<std::string>("Storage"));
+            debugLog() << storage.describe() << std::endl;
+
+            // a whole number of equal steps covers exactly T
+            size_t nStep = std::max<size_t>(1, (size_t) std::ceil(std::abs(T) / dStep));
+            double h = T / nStep;
+
+            // flow map: end position of every sample, one sampler per thread
+            auto start = std::chrono::steady_clock::now();
+            size_t nSamples = extent[0] * extent[1] * extent[2];
+            std::vector<double> fx(nSamples), fy(nSamples), fz(nSamples);
+            std::vector<std::unique_ptr<tasks::VelocitySampler>> samplers(tasks::numThreads());
+            for (auto &sampler : samplers) {
+                sampler = storage.makeSampler();
+            }
+            size_t nPackets = (nSamples + packetSize - 1) / packetSize;
+            tasks::parallelForDynamic(0, nPackets, 16, [&](size_t b, size_t e, size_t t) {
+                for (size_t packet = b; packet < e && !abortFlag; packet++) {
+                    size_t first = packet * packetSize;
+                    size_t n = std::min(packetSize, nSamples - first);
+                    double px[packetSize] = {}, py[packetSize] = {}, pz[packetSize] = {};
+                    for (size_t l = 0; l < n; l++) {
+                        size_t i = first + l;
+                        px[l] = origin[0] + (i % extent[0]) * spacing[0];
+                        py[l] = origin[1] + (i / extent[0] % extent[1]) * spacing[1];
+                        pz[l] = origin[2] + (i / (extent[0] * extent[1])) * spacing[2];
+                    }
+                    tracePacket(*samplers[t], rungeKutta, h, nStep, n, px, py, pz);
+                    for (size_t l = 0; l < n; l++) {
+                        fx[first + l] = px[l];
+                        fy[first + l] = py[l];
+                        fz[first + l] = pz[l];
+                    }
+                }
+            });
+            if (abortFlag) return;
+            double traceSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            // flow map gradient by central differences, one sided at the border.
+            // Axes with a single sample do not stretch.
+            std::vector<Scalar> values(nSamples);
+            const std::vector<double> *flow[3] = {&fx, &fy, &fz};
+            size_t stride[3] = {1, extent[0], extent[0] * extent[1]};
+            double maxFtle = 0.0;
+            std::vector<double> threadMax(tasks::numThreads(), 0.0);
+            tasks::parallelFor(0, nSamples, [&](size_t b, size_t e, size_t t) {
+                for (size_t i = b; i < e; i++) {
+                    size_t ijk[3] = {i % extent[0], i / extent[0] % extent[1], i / (extent[0] * extent[1])};
+                    double J[3][3];
+                    for (size_t d = 0; d < 3; d++) {
+                        if (extent[d] < 2) {
+                            for (size_t r = 0; r < 3; r++) {
+                                J[r][d] = r == d ? 1.0 : 0.0;
+                            }
+                            continue;
+                        }
+                        size_t lo = ijk[d] > 0 ? i - stride[d] : i;
+                        size_t hi = ijk[d] + 1 < extent[d] ? i + stride[d] : i;
+                        double dist = (hi - lo) / stride[d] * spacing[d];
+                        for (size_t r = 0; r < 3; r++) {
+                            J[r][d] = ((*flow[r])[hi] - (*flow[r])[lo]) / dist;
+                        }
+                    }
+                    // right Cauchy-Green tensor J^T J
+                    double C[3][3];
+                    for (size_t r = 0; r < 3; r++) {
+                        for (size_t c = 0; c < 3; c++) {
+                            C[r][c] = J[0][r] * J[0][c] + J[1][r] * J[1][c] + J[2][r] * J[2][c];
+                        }
+                    }
+                    double lambda = maxEigenvalue(C);
+                    double ftle = lambda > 0.0 ? std::log(std::sqrt(lambda)) / std::abs(T) : 0.0;
+                    values[i] = Scalar(ftle);
+                    threadMax[t] = std::max(threadMax[t], ftle);
+                }
+            });
+            for (double m : threadMax) {
+                maxFtle = std::max(maxFtle, m);
+            }
+
+            debugLog() << "FTLE: " << nSamples << " samples, " << nStep << " steps each, traced in "
+                       << traceSeconds << " s on " << tasks::numThreads() << " threads, max " << maxFtle << std::endl;
+
+            std::shared_ptr<const Grid<3>> grid = DomainFactory::makeUniformGrid(extent, origin, spacing);
+            setResult("FTLE", addData(grid, Grid<3>::Points, std::move(values)));
+        }
+    };
+    AlgorithmRegister<FtleTask> dummy("Tasks/FTLE", "Finite-time Lyapunov exponents of an input vector field");
+}
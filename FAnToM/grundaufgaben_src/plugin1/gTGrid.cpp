@@ -7,6 +7,12 @@
 #include <fantom-plugins/utils/Graphics/HelperFunctions.hpp>
 #include <fantom-plugins/utils/Graphics/ObjectRenderer.hpp>
 
+#include "evenSeeding.hpp"
+#include "fieldStorage.hpp"
+#include "lineSimplification.hpp"
+#include "meshExport.hpp"
+#include "seedGenerators.hpp"
+
 #include <vector>
 #include <math.h>
 #include <cmath>
@@ -45,6 +51,21 @@ namespace
                 add<double>("dStep", "distance between steps", 0.05);
                 add<double>("adStep", "for calculating new step size", 0.02);
                 add<size_t>("nStep", "max number of steps", 100);
+                add<InputChoices>("Seeds", "how seeds are placed in the grid box", tasks::seedChoices(), "Uniform");
+                add<size_t>("Random seed", "for jittered, random and Poisson disk seeds", 0);
+                add<std::string>("Polyline", "seed curve as x y z points separated by commas, nx * ny * nz seeds", "-4 0.5 1, -4 6.5 5");
+                add<std::string>("Plane normal", "seed plane through the origin, nx * ny seeds spaced dx, dy", "1 0 0");
+                add<InputChoices>("Seeding", "where lines start", std::vector<std::string>{"Grid", "Evenly spaced"}, "Grid");
+                add<double>("dSep", "distance between evenly spaced lines", 0.5);
+                add<double>("dTest", "evenly spaced lines stop closer than dTest * dSep to another line", 0.5);
+                add<InputChoices>("Storage", "in-memory velocity representation", tasks::FieldStorage::choices(), "Double");
+                add<bool>("Compare storage", "log the error of the compressed velocities", false);
+                add<size_t>("Cache size", "recent velocity samples kept per sampler, 0 disables the cache", 0);
+                add<double>("Cache tolerance", "max difference in local cell coordinates for reusing a sample", 0.0);
+                add<double>("Simplify", "max distance of dropped points to the drawn lines and the surface built from them, 0 draws every step", 0.0);
+                add<std::string>("Export file", "binary file every line and surface triangle is written to as soon as it is made, empty for none", "");
+                add<InputChoices>("Export format", "binary PLY or legacy VTK PolyData", tasks::exportChoices(), "PLY");
+                add<bool>("Export only", "keep no lines or triangles for drawing, only the file gets them", false);
                 addSeparator();
                 add<Color>("colorGrid", "The color of the grid", Color(1.0, 1.0, 1.0));
                 add<Color>("colorStream", "The color of the streamlines", Color(1.0, 0.0, 0.0));
@@ -71,10 +92,12 @@ namespace
         static void makeEuler(double &dStep, double &adStep, size_t nStep,
                           double &x, double &y, double &z, 
                           std::vector<Point<3>> &points, 
-                          std::shared_ptr<const Field<3, Vector3>> &field) {
+                          std::unique_ptr<tasks::VelocitySampler> &evaluator,
+                          const tasks::EvenSeeder *seeder = nullptr) {
             while (points.size() < nStep) {
                 Point3 p = {x, y, z};
-                auto evaluator = field->makeEvaluator();
+                // evenly spaced lines end where they come too close to another one
+                if (seeder && !seeder->accept(p)) return;
 
                 // check if in domain
                 if (evaluator->reset(p)) {
@@ -144,10 +167,11 @@ namespace
         static void makeRungeKutta(double &dStep, size_t nStep,
                                double &x, double &y, double &z, 
                                std::vector<Point<3>> &points, 
-                               std::shared_ptr<const Field<3, Vector3>> &field) {
+                               std::unique_ptr<tasks::VelocitySampler> &evaluator,
+                               const tasks::EvenSeeder *seeder = nullptr) {
             while (points.size() < nStep) {
-                auto evaluator = field->makeEvaluator();
                 Point3 p = {x, y, z};
+                if (seeder && !seeder->accept(p)) return;
 
                 double q1x, q1y, q1z;
                 double q2x, q2y, q2z;
@@ -172,7 +196,6 @@ namespace
                 // if point is not in the domain, exit the loop
                 else
                 {
-                    //std::cout << "Point is outside of the domain" << std::endl;
                     return;
                 }
 
@@ -220,9 +243,13 @@ namespace
                               + pow(p[2] - q[2], 2));
         }
 
+        // the triangle goes to the writer if there is one, and is kept unless only exported
         static void makeTriangle(std::vector<PointF<3>> &surfacePoints, 
                                 std::vector<unsigned int> &surfaceIndexes, 
-                                Point<3> &p1, Point<3> &p2, Point<3> &p3) {
+                                Point<3> &p1, Point<3> &p2, Point<3> &p3,
+                                tasks::MeshWriter *writer, bool keep) {
+            if (writer) writer->addTriangle(p1, p2, p3);
+            if (!keep) return;
             PointF<3> addPoint[] = {PointF<3> (p1), 
                                     PointF<3> (p2), 
                                     PointF<3> (p3)};
@@ -267,7 +294,8 @@ namespace
                                 std::vector<std::vector<size_t>> &posFront,
                                 size_t nL, 
                                 std::vector<PointF<3>> &surfacePoints, 
-                                std::vector<unsigned int> &surfaceIndexes) {
+                                std::vector<unsigned int> &surfaceIndexes,
+                                tasks::MeshWriter *writer, bool keep) {
             float prevDiag = INFINITY;
             bool caughtUp = false;
             if (nL >= streamList.size() - 1) {return;}
@@ -284,35 +312,31 @@ namespace
                 bool advanceOnLeft = (lDiag == minDiag);
 
                 if(posFront[nL][0] >= streamList[nL].size()-1) {
-                    std::cout << "Finished" << nL << std::endl;
                     return;
                 }
                 if(caughtUp && (advanceOnLeft || rDiag > prevDiag)) {    
-                    std::cout << "Caught Up" << std::endl;
                     return;
                 }
                 if (advanceOnLeft) {
                     makeTriangle(surfacePoints, 
                                  surfaceIndexes, 
-                                 l0, r0, l1);
-                    std::cout << "Added Triangle L" << std::endl;
+                                 l0, r0, l1, writer, keep);
                     posFront[nL][0]++;
                     caughtUp = true;
                 } else {
                     makeTriangle(surfacePoints, 
                                  surfaceIndexes, 
-                                 l0, r0, r1);
-                    std::cout << "Added Triangle R" << nL << "immernoch < " << streamList.size() << std::endl;
+                                 l0, r0, r1, writer, keep);
                     posFront[nL + 1][1]++;
                     if (nL > streamList.size() - 2) {
-                        std::cout << "exiting" << std::endl;
                         return;
                     }
                     advanceRibbon(streamList, 
                                   posFront, 
                                   nL + 1,
                                   surfacePoints,
-                                  surfaceIndexes);
+                                  surfaceIndexes,
+                                  writer, keep);
                 }
                 prevDiag = minDiag;
             }
@@ -364,7 +388,7 @@ namespace
 
         virtual void execute(const Algorithm::Options &options, const volatile bool & /*abortFlag*/) override
         {
-            // make a structured grid to start lines at edges
+            // box of the seeds, lines start at its grid points unless another seeding is chosen
             double origin[] = { options.get< double >("ox"),
                                 options.get< double >("oy"),
                                 options.get< double >("oz")};
@@ -374,31 +398,21 @@ namespace
             double spacing[] = {options.get< double >("dx"), 
                                 options.get< double >("dy"), 
                                 options.get< double >("dz")};
-            std::shared_ptr< const Grid< 3 > > grid = DomainFactory::makeUniformGrid( extent, origin, spacing );
-            const ValueArray< Point3 >& pointsGrid = grid->points();
+            // seeds are generated on the fly, the grid lines only outline where they come from
+            auto makeSeeds = [&]() {
+                return tasks::makeSeedGenerator(options.get<std::string>("Seeds"), origin, extent, spacing,
+                                                (unsigned int) options.get<size_t>("Random seed"),
+                                                options.get<std::string>("Polyline"),
+                                                options.get<std::string>("Plane normal"));
+            };
+            std::unique_ptr<tasks::SeedGenerator> generator = makeSeeds();
             std::vector<VectorF<3>> connectGrid;
             std::vector<PointF<3>> pointFGrid;
-            
-            // for cell in grid
-            for (size_t i = 0; i < grid->numCells(); i++) {
-                Cell cell = grid->cell( i );
-                std::vector<size_t> connections = {0,1, 1,2, 2,3, 3,0,
-                                                   7,6, 6,5, 5,4, 4,7,
-                                                   0,7, 1,6, 2,5, 3,4 };
-
-                // std::vector<size_t> connections = { 0,1,1,2,2,3,3,0,0,7,7,6,6,1,6,5,5,2,5,4,4,3,4,7 };
-
-                // make points array to pointf vector
-                for (size_t j = 0; j < 8; j++) {
-                    Point3 p = pointsGrid[cell.index( j )];
-                    pointFGrid.push_back(PointF<3>(p[0], p[1], p[2]));
-                }
-
-                // make connections of grid to connect vector
-                for (size_t k = 0; k < connections.size(); k++) {
-                    Point3 p = pointsGrid[cell.index( connections[k] )];
-                    connectGrid.push_back(VectorF<3>(p));
-                }
+            std::vector<Point3> outline;
+            generator->outline(outline);
+            for (const Point3 &p : outline) {
+                pointFGrid.push_back(PointF<3>(p[0], p[1], p[2]));
+                connectGrid.push_back(VectorF<3>(p));
             }
 
             std::string oSurface = options.get<std::string>("Surface");
@@ -424,48 +438,100 @@ namespace
                 throw std::logic_error("Wrong type of grid!");
             }
 
+            tasks::FieldStorage storage(field, function,
+                                        options.get<std::string>("Storage"));
+            debugLog() << storage.describe() << std::endl;
+            if (options.get<bool>("Compare storage") && storage.ownInterpolation()) {
+                debugLog() << storage.describe(storage.compare()) << std::endl;
+            }
+            size_t cacheSize = options.get<size_t>("Cache size");
+            if (!storage.useCache(cacheSize, options.get<double>("Cache tolerance"))) {
+                debugLog() << "sample cache needs a lattice or compressed storage, tracing without it" << std::endl;
+            }
+            auto evaluator = storage.makeSampler();
+
+            std::unique_ptr<tasks::MeshWriter> writer;
+            bool exportOnly = false;
+            if (!options.get<std::string>("Export file").empty()) {
+                writer.reset(new tasks::MeshWriter(options.get<std::string>("Export file"), options.get<std::string>("Export format")));
+                if (!writer->good()) {
+                    debugLog() << "cannot write " << options.get<std::string>("Export file") << std::endl;
+                    writer.reset();
+                } else {
+                    exportOnly = options.get<bool>("Export only");
+                }
+            }
+
             // prepare for surface
             std::vector<std::vector<Point<3>>> streamList;
             // prepare for the streams
             std::vector<VectorF<3>> connectStream;
             std::vector<PointF<3>> pointFStream;
+            auto addStream = [&](const std::vector<Point<3>> &points) {
+                // fill vector with all stream points and make connections between them in vectorF vector
+                for (size_t j = 0; j < points.size(); j++) {
+                    if (points.size() < 2) {
+                        break;
+                    }
+                    pointFStream.push_back(PointF<3>(points[j][0], points[j][1], points[j][2]));
+                    if (j != 0 && j != points.size() - 1) {
+                        connectStream.push_back(VectorF<3>(points[j]));
+                    }
+                    connectStream.push_back(VectorF<3>(points[j]));
+                }
+            };
+
+            // evenly spaced seeding starts at the grid points and picks the rest itself
+            std::unique_ptr<tasks::EvenSeeder> seeder;
+            if (options.get<std::string>("Seeding") == "Evenly spaced") {
+                double dSep = options.get<double>("dSep");
+                seeder.reset(new tasks::EvenSeeder(dSep, options.get<double>("dTest") * dSep, makeSeeds()));
+            }
 
-            // all points of the grid make a stream
-            for (size_t i = 0; i < grid->numPoints(); i++) {
-                std::cout << i << std::endl;
+            // every seed makes a stream, the lines are only kept for the surface or to simplify them
+            double tolerance = options.get<double>("Simplify");
+            bool keepLines = oSurface == "Yes" || (tolerance > 0.0 && !exportOnly);
+            size_t seeds = 0, streamPoints = 0;
+            for (;; seeds++) {
                 // get starting coords
-                Point3 p = grid->points()[i];
+                Point3 p;
+                if (!seeder ? !generator->next(p) : !seeder->next(*evaluator, p)) break;
                 double x = p[0], y = p[1], z = p[2];
                 std::vector<Point<3>> points;
 
-                auto evaluator = field->makeEvaluator();
                 if (!evaluator->reset(p)) continue;
 
                 if (method == "Euler") {
-                    makeEuler(dStep, adStep, nStep, x, y, z, points, field);
+                    makeEuler(dStep, adStep, nStep, x, y, z, points, evaluator, seeder.get());
                 }
                 else if (method == "Runge-Kutta") {
-                    makeRungeKutta(dStep, nStep, x, y, z, points, field);
+                    makeRungeKutta(dStep, nStep, x, y, z, points, evaluator, seeder.get());
                 }
                 else {
-                    std::cout << "Something went wrong" << std::endl;
+                    debugLog() << "Something went wrong" << std::endl;
                 }
-
-                // fill vector with all stream points and make connections between them in vectorF vector
-                for (size_t j = 0; j < points.size(); j++) {
-                    if (points.size() < 2) {
-                        break;
-                    }
-                    pointFStream.push_back(PointF<3>(points[j][0], points[j][1], points[j][2]));
-                    if (j != 0 && j != points.size() - 1) {
-                        connectStream.push_back(VectorF<3>(points[j]));
-                    }
-                    connectStream.push_back(VectorF<3>(points[j]));
+                if (seeder) seeder->addLine(points);
+                if (writer) writer->addLine(points);
+
+                streamPoints += points.size();
+                if (keepLines && points.size() > 1) {
+                    streamList.push_back(std::move(points));
+                } else if (!keepLines && !exportOnly) {
+                    addStream(points);
                 }
-                if (oSurface == "Yes" && points.size() > 1) {
-                    streamList.push_back(points);
-                    std::cout << streamList.size() << std::endl;
-                    std::cout << points.size() << std::endl;
+            }
+            debugLog() << seeds << " seeds traced to " << streamPoints << " points" << std::endl;
+            if (seeder) {
+                debugLog() << seeder->describe() << std::endl;
+            }
+
+            // the surface is built from the drawn lines, simplified or not
+            if (tolerance > 0.0 && !streamList.empty()) {
+                debugLog() << tasks::simplifyLines(streamList, tolerance) << std::endl;
+            }
+            if (keepLines && !exportOnly) {
+                for (const auto &points : streamList) {
+                    addStream(points);
                 }
             }
             //std::set<PointF<3>> surfacePointsSet;
@@ -476,24 +542,31 @@ namespace
             //advanceRibbonSimp(streamList, posFront, 0, surfacePoints, surfaceIndexes);
             //position marker for finished streamline
             size_t nL = 0;
-            while((posFront[0][0] < streamList[0].size()-1 
+            while(oSurface == "Yes" && !streamList.empty()
+                  && (posFront[0][0] < streamList[0].size()-1 
                    || posFront[streamList.size()-1][1] < streamList[streamList.size()-1].size()-1) 
                    && nL < streamList.size() - 3) {
                 if(posFront[nL][0] >= streamList[nL].size()-1) {
                     nL++;
-                    std::cout << nL << std::endl;
                 }
-                advanceRibbon(streamList, posFront, nL, surfacePoints, surfaceIndexes);
+                advanceRibbon(streamList, posFront, nL, surfacePoints, surfaceIndexes, writer.get(), !exportOnly);
+            }
+            if (writer) {
+                writer->close();
+                debugLog() << writer->describe() << std::endl;
             }
 
             // convert set to vector
             // std::vector<PointF<3>> surfacePoints(surfacePointsSet.begin(), surfacePointsSet.end());
 
+            if (cacheSize && storage.ownInterpolation()) {
+                debugLog() << storage.describeCache() << std::endl;
+            }
+
             // making the visualization
             std::shared_ptr<graphics::Drawable> gridLines = drawLines(pointFGrid, connectGrid, colorGrid);
             std::shared_ptr<graphics::Drawable> streamlines = drawLines(pointFStream, connectStream, colorStream);
             std::shared_ptr<graphics::Drawable> surface = drawSurface(surfacePoints, surfaceIndexes, colorStream);
-            std::cout << "drew everything" << std::endl;
             setGraphics("grid", gridLines);   
             setGraphics("streams", streamlines);
             setGraphics("surface", surface);
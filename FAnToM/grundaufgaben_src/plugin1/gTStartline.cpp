@@ -7,6 +7,8 @@
 #include <fantom-plugins/utils/Graphics/HelperFunctions.hpp>
 #include <fantom-plugins/utils/Graphics/ObjectRenderer.hpp>
 
+#include "fieldStorage.hpp"
+
 #include <vector>
 #include <math.h>
 #include <cmath>
@@ -39,6 +41,7 @@ namespace
                 add<double>("dStep", "distance between steps", 0.05);
                 add<double>("adStep", "for calculating new step size", 0.02);
                 add<size_t>("nStep", "max number of steps", 100);
+                add<InputChoices>("Storage", "in-memory velocity representation", tasks::FieldStorage::choices(), "Double");
                 addSeparator();
                 add<Color>("colorStartLine", "The color of the start line", Color(1.0, 1.0, 0.0));
                 add<Color>("colorStream", "The color of the streamlines", Color(1.0, 0.0, 0.0));
@@ -68,7 +71,7 @@ namespace
                                 double& dStep,
                                 double& adStep,
                                 unsigned int& nStep,
-                             std::unique_ptr<FieldEvaluator<3UL, Vector3>>& evaluator) {
+                             std::unique_ptr<tasks::VelocitySampler>& evaluator) {
             nStep++; 
             nStep--;
             if (method == "Euler") stepEuler(vec, p, dStep, adStep, evaluator);
@@ -79,7 +82,7 @@ namespace
                               Point<3> p,
                               double& dStep,
                               double& adStep,
-                              std::unique_ptr<FieldEvaluator<3UL, Vector3>>& evaluator) {
+                              std::unique_ptr<tasks::VelocitySampler>& evaluator) {
             if (evaluator->reset(p)) {
                 auto v = evaluator->value();
                 //if there is no velocity at this point stop the loop
@@ -116,7 +119,7 @@ namespace
         static void stepRungeKutta(std::vector<Point<3>>& vec,
                                    Point<3> p,
                                 double& dStep,
-                                   std::unique_ptr<FieldEvaluator<3UL, Vector3>>& evaluator) {
+                                   std::unique_ptr<tasks::VelocitySampler>& evaluator) {
             Point<3> n = {0, 0, 0};
             std::vector<Point<3>> q = {n, n, n, n};
             if (evaluator->reset(p)) {
@@ -315,13 +318,16 @@ namespace
                 debugLog() << "Input Field not set." << std::endl;
                 return;
             }
-            auto evaluator = field->makeEvaluator();
 
             // sanity check that interpolated fields really use the correct grid type. This should never fail
             std::shared_ptr<const Grid<3>> functionDomainGrid = std::dynamic_pointer_cast<const Grid<3>>(function->domain());
             if (!functionDomainGrid) {
                 throw std::logic_error("Wrong type of grid!");
             }
+
+            tasks::FieldStorage storage(field, function, options.get<std::string>("Storage"));
+            debugLog() << storage.describe() << std::endl;
+            auto evaluator = storage.makeSampler();
             //make vectors for startline
             std::vector<PointF<3>> startPoints = {(PointF<3>)startcoord, (PointF<3>)endcoord};
             std::vector<VectorF<3>> startVectors = {(VectorF<3>)startcoord, (VectorF<3>)endcoord};
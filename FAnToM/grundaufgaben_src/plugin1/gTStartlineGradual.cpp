@@ -7,11 +7,21 @@
 #include <fantom-plugins/utils/Graphics/HelperFunctions.hpp>
 #include <fantom-plugins/utils/Graphics/ObjectRenderer.hpp>
 
+#include "fieldStorage.hpp"
+#include "importanceSeeding.hpp"
+#include "meshDecimation.hpp"
+#include "meshExport.hpp"
+#include "parallel.hpp"
+#include "ribbonFront.hpp"
+#include "seedCurves.hpp"
+#include "surfaceMesh.hpp"
+#include "timeSeries.hpp"
+
+#include <algorithm>
+#include <sstream>
 #include <vector>
 #include <math.h>
-#include <unistd.h>
 #include <cmath>
-//#include <algorithm>
 
 using namespace fantom;
 
@@ -34,12 +44,43 @@ namespace
                 add< double >( "ex", "end point in x-dimension", -4.0 );
                 add< double >( "ey", "end point in y-dimension", 1.0 );
                 add< double >( "ez", "end point in z-dimension", 7.0 );
+                add<InputChoices>("Seed curve", "the particles start on the segment from start to end, a polyline or spline through the curve points, the circle around start through end, or the line cells of the seed grid", tasks::curveChoices(), "Segment");
+                add<std::string>("Curve points", "polyline or spline as x y z points separated by commas", "-4 -3 -3, -4 0 0, -4 3 3");
+                add<bool>("Closed", "join the last curve point back to the first", false);
+                add<std::string>("Curve normal", "axis of the circle", "1 0 0");
+                add<Grid<3>>("Seed grid", "line cells for Grid lines, every chain of cells starts a surface");
+                add<std::string>("Seed lines", "more curves of the chosen kind separated by semicolons, one surface each; replaces the single curve", "");
+                add<bool>("Surface colours", "give every surface of a batch its own colour", true);
+                add<InputChoices>("Level of detail", "share of the triangles drawn, coarser levels are decimated from the finer ones", tasks::detailChoices(), "Full");
+                add<std::string>("Export file", "binary file the triangles are written to while the surfaces grow, the streamlines at the end, empty for none", "");
+                add<InputChoices>("Export format", "binary PLY or legacy VTK PolyData", tasks::exportChoices(), "PLY");
+                add<bool>("Export only", "keep no triangles for drawing, only the file gets the surfaces", false);
                 addSeparator();
                 add<Field<3, Vector3>>("Field", "3D vector field", definedOn<Grid<3>>(Grid<3>::Points));
                 add<InputChoices>("Method", "calculation method.", std::vector<std::string>{"Euler", "Runge-Kutta"}, "Runge-Kutta");
                 add<double>("dStep", "distance between steps", 0.05);
                 add<double>("adStep", "for calculating new step size", 0.02);
                 add<size_t>("nStep", "max number of steps", 100);
+                add<double>("Max aspect", "split ribbons wider than this times the step length", 3.0);
+                add<double>("Front angle", "split where the front bends more than this many degrees, 0 ignores the bends", 15.0);
+                add<double>("Surface angle", "split where neighbouring streamlines part by more than this many degrees, 0 ignores it", 10.0);
+                add<size_t>("Max particles", "streamlines the surface may start, 0 for no limit", 1000);
+                add<size_t>("Max triangles", "the surface stops at this many triangles, 0 for no limit", 0);
+                add<size_t>("Max memory", "the surface stops at about this many MB, 0 for no limit", 0);
+                add<double>("Merge ratio", "remove a particle when its two ribbons are narrower than this times the step length, 0 keeps all", 0.5);
+                add<InputChoices>("Storage", "in-memory velocity representation", tasks::FieldStorage::choices(), "Double");
+                add<bool>("Compare storage", "log the error of the compressed velocities", false);
+                add<size_t>("Cache size", "recent velocity samples kept per sampler, 0 disables the cache", 0);
+                add<double>("Cache tolerance", "max difference in local cell coordinates for reusing a sample", 0.0);
+                add<InputChoices>("Importance", "space the first particles by a flow feature along the seed curve, e.g. closer where the flow diverges", tasks::featureChoices(), "Off");
+                add<Field<3, Scalar>>("Importance scalar", "feature for the Scalar importance", definedOn<Grid<3>>(Grid<3>::Points));
+                add<bool>("Parallel", "advance every other ribbon at the same time on all cores", false);
+                add<bool>("Timelines", "advance all particles by the same time each round and zip the rows, on all cores", false);
+                add<bool>("Path surface", "trace through the time series instead of the field", false);
+                add<DataObjectBundle>("Time series", "vector fields of consecutive time steps, e.g. from Load/VTK with a Time List");
+                add<std::string>("Time series files", "legacy VTK files of consecutive time steps on the grid of Field, separated by semicolons, wildcards allowed; read one at a time instead of the Time series", "");
+                add<bool>("Prefetch", "read the next time step in the background, which keeps a third one in memory", true);
+                add<double>("dTime", "time between two fields of the series", 1.0);
                 addSeparator();
                 add<Color>("colorStartLine", "The color of the start line", Color(1.0, 1.0, 0.0));
                 add<Color>("colorStream", "The color of the streamlines", Color(1.0, 0.0, 0.0));
@@ -67,7 +108,7 @@ namespace
                              std::string method,
                                 double& dStep,
                                 double& adStep,
-                             std::unique_ptr<FieldEvaluator<3UL, Vector3>>& evaluator) {
+                             std::unique_ptr<tasks::VelocitySampler>& evaluator) {
             if (method == "Euler") return stepEuler(p, dStep, adStep, evaluator);
             else return stepRungeKutta(p, dStep, evaluator);
         }
@@ -75,12 +116,11 @@ namespace
         static Point<3> stepEuler(Point<3> p,
                               double& dStep,
                               double& adStep,
-                              std::unique_ptr<FieldEvaluator<3UL, Vector3>>& evaluator) {
+                              std::unique_ptr<tasks::VelocitySampler>& evaluator) {
             if (evaluator->reset(p)) {
                 auto v = evaluator->value();
                 //if there is no velocity at this point stop the loop
                 if (v[0] == 0 and v[1] == 0 and v[2] == 0) {
-                    std::cout << "1error" << std::endl;
                     return p;
                 }
                 Point<3> s = p + dStep * v;
@@ -110,19 +150,17 @@ namespace
 
         static Point<3> stepRungeKutta(Point<3> p,
                                        double& dStep,
-                                       std::unique_ptr<FieldEvaluator<3UL, Vector3>>& evaluator) {
+                                       std::unique_ptr<tasks::VelocitySampler>& evaluator) {
             Point<3> n = {0, 0, 0};
             std::vector<Point<3>> q = {n, n, n, n};
             if (evaluator->reset(p)) {
                 auto v = evaluator->value();
                 // if there is no velocity at this point stop the loop
                 if (v[0] == 0 and v[1] == 0 and v[2] == 0) {
-                    std::cout << "1error" << std::endl;
                     return p;
                 }
                 q[0] = (dStep * v);
             } else {
-                std::cout << "2error" << std::endl;
                 return p;
             }
 
@@ -134,7 +172,6 @@ namespace
             }
 
             n = p + (q[0] + 2 * q[1] + 2 * q[2] + q[3]) / 6;
-            // std::cout << "added " << n << " by way of " << p << (q[0] + 2 * q[1] + 2 * q[2] + q[3]) / 6 << std::endl;
             if (evaluator->reset(n)) {
                 return n;
             }
@@ -147,22 +184,144 @@ namespace
                               + pow(p[2] - q[2], 2));
         }
 
-        static void makeTriangle(std::vector<PointF<3>> &surfacePoints, 
-                                std::vector<unsigned int> &surfaceIndexes, 
-                                Point<3> &p1, Point<3> &p2, Point<3> &p3) {
-            PointF<3> addPoint[] = {PointF<3> (p1), 
-                                    PointF<3> (p2), 
-                                    PointF<3> (p3)};
-            for(size_t i = 0; i < 3; i++) {
-                surfacePoints.push_back(addPoint[i]);
-                surfaceIndexes.push_back(surfacePoints.size()-1);
-            }
-            return;
+        static tasks::Sample sample(size_t line, size_t step) {
+            return {(std::uint32_t) line, (std::uint32_t) step};
+        }
+
+        // when the front gets split and merged, angles in radians, 0 turns a test off
+        struct Refinement
+        {
+            double aspect;       // split ribbons wider than this times the step length
+            double frontAngle;   // split where the front bends more than this at a ribbon
+            double surfaceAngle; // split where the two streamlines of a ribbon part more than this
+            double mergeRatio;   // merge two ribbons narrower than this times the step length
+        };
+
+        // Limits of the surface, 0 leaves one open. Running out of particles
+        // only stops the refinement, out of triangles or memory the whole
+        // surface stops where it is.
+        struct Budget
+        {
+            size_t particles;
+            size_t triangles;
+            size_t bytes;
+
+            // Memory of streamlines, front and mesh with its output. Every
+            // triangle moves a side one step on and ends up as three corners,
+            // three indexes and about half a vertex with its normal.
+            static size_t estimate(size_t particles, size_t triangles) {
+                return particles * (2 * sizeof(Point<3>) + sizeof(std::vector<Point<3>>) + sizeof(tasks::Ribbon))
+                    + triangles * (sizeof(Point<3>) + 3 * sizeof(tasks::Sample) + 3 * sizeof(unsigned int)
+                                   + (sizeof(PointF<3>) + sizeof(VectorF<3>)) / 2);
+            }
+
+            bool exhausted(size_t usedParticles, size_t usedTriangles) const {
+                return (triangles && usedTriangles >= triangles)
+                    || (bytes && estimate(usedParticles, usedTriangles) >= bytes);
+            }
+
+            // The factor a split has to break its tolerance by. With fewer
+            // particles left than ribbons on the front it grows to front / left,
+            // so the last particles go where the error is largest.
+            double threshold(size_t usedParticles, size_t usedTriangles, size_t ribbons) const {
+                if ((particles && usedParticles >= particles)
+                    || (bytes && estimate(usedParticles + 1, usedTriangles) >= bytes)) {
+                    return INFINITY;
+                }
+                if (!particles) return 1.0;
+                return std::max(1.0, double(ribbons) / (particles - usedParticles));
+            }
+
+            std::string describe(size_t usedParticles, size_t usedTriangles) const {
+                std::ostringstream s;
+                s << "budget: " << usedParticles << " particles";
+                if (particles) s << " of " << particles;
+                s << ", " << usedTriangles << " triangles";
+                if (triangles) s << " of " << triangles;
+                s << ", about " << estimate(usedParticles, usedTriangles) / 1048576.0 << " MB";
+                if (bytes) s << " of " << bytes / 1048576.0 << " MB";
+                return s.str();
+            }
+        };
+
+        // One stream surface of a batch: its streamlines and triangles, the
+        // seed spacing, and the step sizes the adaptive Euler method changes
+        // as the surface grows.
+        struct Surface
+        {
+            std::vector<std::vector<Point<3>>> streamList;
+            tasks::SurfaceMesh mesh;
+            double spacing = 0;
+            bool closed = false;
+            double dStep = 0, adStep = 0;
+            int rem = 0;       // particles removed
+            size_t left = 0;   // particles on the front at the end
+        };
+
+        // angle between two directions, 0 if one of them vanishes
+        static double angleBetween(const Vector3 &a, const Vector3 &b) {
+            double ab = a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+            double l = std::sqrt((a[0] * a[0] + a[1] * a[1] + a[2] * a[2]) * (b[0] * b[0] + b[1] * b[1] + b[2] * b[2]));
+            return l > 0 ? std::acos(std::min(1.0, std::max(-1.0, ab / l))) : 0.0;
+        }
+
+        // d without its part along the flow direction t. Neighbouring ribbons
+        // are a step or so apart along the flow, which would tilt the front
+        // segments between them without any bend of the surface.
+        static Vector3 across(const Vector3 &d, const Vector3 &t) {
+            double tt = t[0] * t[0] + t[1] * t[1] + t[2] * t[2];
+            if (!(tt > 0)) return d;
+            return d - ((d[0] * t[0] + d[1] * t[1] + d[2] * t[2]) / tt) * t;
+        }
+
+        // the point a ribbon side reached, clamped to the streamline
+        static Point<3> frontPoint(const std::vector<Point<3>> &line, size_t pos) {
+            return line[std::min(pos, line.size() - 1)];
+        }
+
+        // How much ribbon nL needs a particle between its sides, above 1 once
+        // it breaks a tolerance: it is too wide for the step length, or, once
+        // wider than one step, its streamlines part or the front bends too
+        // much at its ends, measured across the flow. The factor of the worst
+        // test is returned, so splits can be ranked when the budget runs low.
+        // The front angle looks at the neighbouring ribbons, whose streamlines
+        // other threads extend during a parallel phase, so that mode goes
+        // without it.
+        static double splitError(const std::vector<std::vector<Point<3>>> &streamList,
+                                 const tasks::RibbonFront &front,
+                                 tasks::RibbonFront::Handle nL,
+                                 Point<3> l0, Point<3> l1, Point<3> r0, Point<3> r1,
+                                 const Refinement &refine,
+                                 bool neighbours = true) {
+            // torn ribbons draw nothing, splitting them would only waste particles
+            if (!front[nL].alive || front[nL].posL > front[nL].maxStep - 10) {
+                return 0;
+            }
+            double width = euclidDist(l1, r1);
+            double height = euclidDist(l0, l1);
+            double error = height > 0 ? width / (refine.aspect * height) : 0;
+            if (!(height > 0) || width <= height) return error;
+            if (refine.surfaceAngle > 0) {
+                error = std::max(error, angleBetween(l1 - l0, r1 - r0) / refine.surfaceAngle);
+            }
+            if (refine.frontAngle > 0 && neighbours) {
+                tasks::RibbonFront::Handle left = front.prev(nL), right = front.next(nL);
+                // a torn neighbour has stopped, its front is no bend of the surface
+                if (left != tasks::RibbonFront::None && front[left].alive) {
+                    error = std::max(error, angleBetween(across(l1 - frontPoint(streamList[front[left].lineL], front[left].posL + 1), l1 - l0),
+                                                         across(r1 - l1, l1 - l0)) / refine.frontAngle);
+                }
+                if (right != tasks::RibbonFront::None && front[right].alive) {
+                    error = std::max(error, angleBetween(across(r1 - l1, r1 - r0),
+                                                         across(frontPoint(streamList[front[right].lineR], front[right].posR + 1) - r1, r1 - r0)) / refine.frontAngle);
+                }
+            }
+            return error;
         }
 
         static bool addParticle(std::vector<std::vector<Point<3>>> &streamList, 
-                                std::vector<std::vector<size_t>> &posFront,
-                                size_t nL,
+                                tasks::RibbonFront &front,
+                                tasks::RibbonFront::Handle nL,
                                 size_t posL0, size_t posR0,
                                 Point<3> l0, Point<3> l1,
                                 Point<3> r0, Point<3> r1,
@@ -170,11 +329,10 @@ namespace
                                 double& dStep,
                                 double& adStep,
                                 unsigned int& nStep,
-                                std::unique_ptr<FieldEvaluator<3UL, Vector3>>& evaluator) {
-            if (posFront[nL][0] > posFront[nL][4] - 10 || streamList.size() > 1000) {
-                return false;
-            }
-            if (euclidDist(l1, r1) > 2 * euclidDist(l0, l1)) {
+                                std::unique_ptr<tasks::VelocitySampler>& evaluator,
+                                const Refinement &refine,
+                                double threshold) {
+            if (splitError(streamList, front, nL, l0, l1, r0, r1, refine) > threshold) {
                 Point<3> newP = l1 + ((r1 - l1) / 2);
                 std::vector<Point<3>> newTracer;
                 newTracer.push_back(newP);
@@ -182,166 +340,522 @@ namespace
                     newTracer.push_back(makeStep(newTracer[j], method, dStep, adStep, evaluator));
                 }
                 streamList.push_back(newTracer);
-                posFront.insert(posFront.begin() + nL + 1, {0,posR0 + 1,
-                                                streamList.size() - 1,posFront[nL][3],nStep - posL0, 1});
-                posFront[nL][1] = 0;
-                posFront[nL][3] = streamList.size() - 1;
-                // std::cout << "added" << std::endl;
+                tasks::Ribbon ribbon = {0, (std::uint32_t) posR0 + 1,
+                                        (std::uint32_t) streamList.size() - 1, front[nL].lineR,
+                                        (std::uint32_t) (nStep - posL0), 1};
+                front.insertAfter(nL, ribbon);
+                front[nL].posR = 0;
+                front[nL].lineR = streamList.size() - 1;
                 return true;
             } else {
                 return false;
             }
         }
 
-        static bool remParticle(std::vector<std::vector<Point<3>>> &streamList, 
-                                std::vector<std::vector<size_t>> &posFront,
-                                std::vector<PointF<3>> &surfacePoints, 
-                                std::vector<unsigned int> &surfaceIndexes, 
-                                size_t nL,
-                                Point<3> l0, Point<3> l1,
-                                Point<3> r0, Point<3> r1){
-            if (posFront[nL][0] > posFront[nL][4] - 5 || nL < 1) return false;
-            size_t strL = posFront[nL - 1][2];
-            Point<3> m0 = l0;
-            // Point<3> m1 = l1;
-            l0 = streamList[strL][posFront[nL-1][0] - 1];
-            l1 = streamList[strL][posFront[nL-1][0]];
-            double height = (euclidDist(l0,l1) + euclidDist(r0,r1)) / 2;
-            double width  = euclidDist(l1,r1);
-            // if ((nL == 50 && posFront[nL][0] == 75) || (nL == 90 &&posFront[nL][0] == 75)) {
-            if (height > width) {
-                posFront[nL - 1][1] = posFront[nL][1];
-                posFront[nL - 1][3] = posFront[nL][3];
-                // streamList.erase(streamList.begin() + nL);
-                posFront.erase(posFront.begin() + nL);
-                makeTriangle(surfacePoints, surfaceIndexes, m0,r1,l1);
-                makeTriangle(surfacePoints, surfaceIndexes, m0,r0,r1);
-                std::cout << "dood" << std::endl;
-                return true;
+        // Removes the particle between ribbon nL and its right neighbour once
+        // the two together are narrower than mergeRatio times their step
+        // length, or where both angles stay below half their tolerance and
+        // the two are narrower than half the aspect, so flat regions coarsen
+        // without splitError asking for a split right again. The front then runs from
+        // the left straight to the right streamline: a fan closes the part of
+        // the middle streamline that one ribbon is ahead on and a last
+        // triangle spans the old corner. The middle streamline is not
+        // integrated any further. mergeRatio should stay below 1.
+        static bool remParticle(const std::vector<std::vector<Point<3>>> &streamList,
+                                tasks::RibbonFront &front,
+                                tasks::SurfaceMesh &mesh,
+                                tasks::RibbonFront::Handle nL,
+                                const Refinement &refine) {
+            tasks::RibbonFront::Handle nR = front.next(nL);
+            if (refine.mergeRatio <= 0 || nR == tasks::RibbonFront::None || !front[nL].alive || !front[nR].alive) return false;
+            size_t strL = front[nL].lineL, strM = front[nL].lineR, strR = front[nR].lineR;
+            size_t posL = front[nL].posL, posR = front[nR].posR;
+            size_t posM0 = front[nL].posR, posM1 = front[nR].posL;
+            // finished ribbons and ends of streamlines stay as they are
+            if (posL + 1 >= streamList[strL].size() || posR + 1 >= streamList[strR].size()
+                || posM0 >= streamList[strM].size() || posM1 >= streamList[strM].size()) {
+                return false;
+            }
+            Point<3> l0 = streamList[strL][posL];
+            Point<3> r0 = streamList[strR][posR];
+            Point<3> m0 = streamList[strM][std::max(posM0, posM1)];
+            Vector3 tangentL = streamList[strL][posL + 1] - l0;
+            Vector3 tangentR = streamList[strR][posR + 1] - r0;
+            double height = (norm(tangentL) + norm(tangentR)) / 2;
+            double width = euclidDist(l0, r0);
+            bool flat = refine.frontAngle > 0 && refine.surfaceAngle > 0
+                && width < refine.aspect * height / 2
+                && angleBetween(across(m0 - l0, tangentL + tangentR), across(r0 - m0, tangentL + tangentR)) < refine.frontAngle / 2
+                && angleBetween(tangentL, tangentR) < refine.surfaceAngle / 2;
+            if (width >= refine.mergeRatio * height && !flat) return false;
+
+            tasks::Sample left = sample(strL, posL), right = sample(strR, posR);
+            for (size_t j = posM1; j < posM0; j++) {
+                mesh.add(sample(strM, j), right, sample(strM, j + 1));
             }
-            return false;
+            for (size_t j = posM0; j < posM1; j++) {
+                mesh.add(left, sample(strM, j), sample(strM, j + 1));
+            }
+            mesh.add(left, sample(strM, std::max(posM0, posM1)), right);
+            front[nL].posR = front[nR].posR;
+            front[nL].lineR = front[nR].lineR;
+            front.erase(nR);
+            return true;
         }
 
-        static bool ripRibbon(std::vector<std::vector<size_t>> &posFront,
-                              size_t nL,
+        // Tears ribbon nL where the flow diverges so strongly that its
+        // streamlines no longer run side by side. The last steps of the two
+        // sides are the velocities the integration already computed, times
+        // the step, so their difference against their sum estimates the
+        // divergence across the ribbon without a square root: with sides of
+        // equal length it tears once they turn more than 120 degrees apart.
+        // A torn ribbon is finished at once and integrates nothing anymore,
+        // its streamlines only grow on where a live neighbour needs them.
+        static bool ripRibbon(tasks::RibbonFront &front,
+                              tasks::RibbonFront::Handle nL,
+                              unsigned int nStep,
                               Point<3> l0, Point<3> l1,
                               Point<3> r0, Point<3> r1) {
-            // if (nL == 75 && posFront[nL][0] == 75) {
-            if (euclidDist((l1 - l0) + (r1 - r0), {0,0,0}) 
-                < (euclidDist(l0, l1) + euclidDist(r0, r1)) / 2) {
-                posFront[nL][5] = 0;
-                return true;
-            } else {
+            Vector3 vL = l1 - l0, vR = r1 - r0;
+            Vector3 d = vR - vL, s = vL + vR;
+            if (d[0] * d[0] + d[1] * d[1] + d[2] * d[2] <= 3 * (s[0] * s[0] + s[1] * s[1] + s[2] * s[2])) {
                 return false;
             }
+            front[nL].alive = 0;
+            front[nL].posL = nStep - 2;
+            front[nL].posR = nStep - 2;
+            return true;
         }
 
-        static void advanceRibbon(std::vector<std::vector<Point<3>>> &streamList, 
-                                std::vector<std::vector<size_t>> &posFront,
-                                std::string method,
-                                double& dStep,
-                                double& adStep,
-                                unsigned int& nStep,
-                                std::unique_ptr<FieldEvaluator<3UL, Vector3>>& evaluator,
-                                size_t nL, int& rem,
-                                std::vector<PointF<3>> &surfacePoints, 
-                                std::vector<unsigned int> &surfaceIndexes) {
-            float prevDiag = INFINITY;
-            bool caughtUp = false;
-            if (nL > posFront.size() - 2) {return;}
-            while(true) {
-                // usleep(10000);
-                size_t strL = posFront[nL][2];
-                size_t strR = posFront[nL][3];
-                size_t posL0 = std::min(streamList[strL].size()-2, posFront[nL][0]);
-                size_t posR0 = std::min(streamList[strR].size()-2, posFront[nL][1]);
-                // define quad to determine shortest diagonal
-                Point<3> l0 = streamList[strL][posL0];
-                Point<3> l1 = streamList[strL][posL0 + 1];
-                Point<3> r0 = streamList[strR][posR0];
-                Point<3> r1 = streamList[strR][posR0 + 1];
-
-                if (addParticle(streamList, posFront, nL, posL0, posR0, l0, l1, r0, r1, method, dStep, adStep, nStep, evaluator)) {
-                    makeTriangle(surfacePoints, surfaceIndexes, l0, r0, streamList[posFront[nL + 1][2]][0]);
-                    posR0 = 0;
-                    strR = posFront[nL][3];
-                    r0 = streamList[strR][0];
-                    r1 = streamList[strR][1];
-                    // std::cout << "added r of " << nL << std::endl;
-                    // continue;
+        // what stepRibbon did with the ribbon on top of the scheduler's stack
+        enum class RibbonStep { Advanced, Neighbour, Done };
+
+        // a ribbon waiting on the scheduler's stack
+        struct RibbonTask
+        {
+            tasks::RibbonFront::Handle nL;
+            float prevDiag;
+            bool caughtUp;
+        };
+
+        // a particle insertion found by a parallel phase, done after it
+        struct Insertion
+        {
+            tasks::RibbonFront::Handle nL;
+            size_t posL0, posR0;
+            Point<3> l0, l1, r0, r1;
+            double error;
+        };
+
+        // the quad ribbon nL takes its next step on
+        static Insertion quad(const std::vector<std::vector<Point<3>>> &streamList,
+                              const tasks::RibbonFront &front,
+                              tasks::RibbonFront::Handle nL) {
+            const std::vector<Point<3>> &left = streamList[front[nL].lineL];
+            const std::vector<Point<3>> &right = streamList[front[nL].lineR];
+            size_t posL0 = std::min(left.size() - 2, (size_t) front[nL].posL);
+            size_t posR0 = std::min(right.size() - 2, (size_t) front[nL].posR);
+            return {nL, posL0, posR0, left[posL0], left[posL0 + 1], right[posR0], right[posR0 + 1], 0};
+        }
+
+        // One quad of ribbon nL: inserts a particle if the ribbon got too wide,
+        // then adds the triangle over the shorter diagonal and moves that side
+        // on. Advancing on the right moves the left side of ribbon nL + 1 too,
+        // which has to catch up before nL goes on (Neighbour).
+        // The parallel phases pass deferred, which gets the insertion instead,
+        // and a target step that neither side goes past; they do not wait for
+        // the neighbours.
+        static RibbonStep stepRibbon(std::vector<std::vector<Point<3>>> &streamList,
+                                     tasks::RibbonFront &front,
+                                     std::string method,
+                                     double& dStep,
+                                     double& adStep,
+                                     unsigned int& nStep,
+                                     std::unique_ptr<tasks::VelocitySampler>& evaluator,
+                                     RibbonTask &task,
+                                     tasks::SurfaceMesh &mesh,
+                                     const Refinement &refine,
+                                     double threshold,
+                                     size_t target = SIZE_MAX,
+                                     std::vector<Insertion> *deferred = nullptr) {
+            tasks::RibbonFront::Handle nL = task.nL;
+            // torn ribbons are finished, a neighbour catching up may still ask
+            if (!front[nL].alive) {
+                return RibbonStep::Done;
+            }
+            size_t strL = front[nL].lineL;
+            size_t strR = front[nL].lineR;
+            // define quad to determine shortest diagonal
+            Insertion q = quad(streamList, front, nL);
+            size_t posL0 = q.posL0, posR0 = q.posR0;
+            Point<3> l0 = q.l0, l1 = q.l1, r0 = q.r0, r1 = q.r1;
+
+            if (deferred) {
+                q.error = splitError(streamList, front, nL, l0, l1, r0, r1, refine, false);
+                if (q.error > threshold) {
+                    deferred->push_back(q);
+                    return RibbonStep::Done;
                 }
-                // else if (remParticle(streamList, posFront, surfacePoints, surfaceIndexes, nL, l0, l1, r0, r1)) {
-                //     std::cout << "removed " << strL << std::endl; 
-                //     rem++;
-                //     return;
-                //     // streamList[posFront[nL - 1][3]].push_back(makeStep(r1, method, dStep, adStep, evaluator));
-                //     // advanceRibbon(streamList, 
-                //     //               posFront, method, dStep, adStep, nStep, 
-                //     //               evaluator,
-                //     //               nL + 1, rem,
-                //     //               surfacePoints,
-                //     //               surfaceIndexes);
-                // }
-                if (ripRibbon(posFront, nL, l0, l1, r0, r1) && posFront[nL][5] != 0) {
-                    // continue;
-                    std::cout << "RIPRIPRIP" << std::endl;
+            } else if (addParticle(streamList, front, nL, posL0, posR0, l0, l1, r0, r1, method, dStep, adStep, nStep, evaluator, refine, threshold)) {
+                mesh.add(sample(strL, posL0), sample(strR, posR0), sample(front[front.next(nL)].lineL, 0));
+                posR0 = 0;
+                strR = front[nL].lineR;
+                r0 = streamList[strR][0];
+                r1 = streamList[strR][1];
+            }
+            if (ripRibbon(front, nL, nStep, l0, l1, r0, r1)) {
+                return RibbonStep::Done;
+            }
+
+            float lDiag = euclidDist(l1, r0);
+            float rDiag = euclidDist(l0, r1);
+            float minDiag = std::min(lDiag, rDiag);
+            bool advanceOnLeft = (lDiag == minDiag);
+            // a side on the last segment of a streamline that cannot grow anymore stays put
+            bool leftEnd = streamList[strL].size() >= nStep - 1 && posL0 >= streamList[strL].size() - 2;
+            bool rightEnd = streamList[strR].size() >= nStep - 1 && posR0 >= streamList[strR].size() - 2;
+            bool leftStop = leftEnd || front[nL].posL >= target;
+            bool rightStop = rightEnd || front[nL].posR >= target;
+            if (leftStop != rightStop) advanceOnLeft = rightStop;
+
+            if(posL0 > nStep - 1 || l0 == l1 || r0 == r1 || (leftEnd && rightEnd)) {
+                front[nL].posL = nStep - 2;
+                front[nL].posR = nStep - 2;
+                return RibbonStep::Done;
+            }
+            if (leftStop && rightStop) {
+                return RibbonStep::Done;
+            }
+            if(!deferred && task.caughtUp && (advanceOnLeft || rDiag > task.prevDiag)) {
+                return RibbonStep::Done;
+            }
+            task.prevDiag = minDiag;
+            if (advanceOnLeft) {
+                mesh.add(sample(strL, posL0), sample(strR, posR0), sample(strL, posL0 + 1));
+                if (streamList[strL].size() < nStep - 1
+                    && posL0 >= streamList[strL].size() - 2) {
+                    streamList[strL].push_back(makeStep(l1, method, dStep, adStep, evaluator));
                 }
+                front[nL].posL++;
+                task.caughtUp = true;
+                return RibbonStep::Advanced;
+            }
+            mesh.add(sample(strL, posL0), sample(strR, posR0), sample(strR, posR0 + 1));
+            if (streamList[strR].size() < nStep - 1
+                && posR0 >= streamList[strR].size() - 2) {
+                streamList[strR].push_back(makeStep(r1, method, dStep, adStep, evaluator));
+            }
+            front[nL].posR++;
+            if (deferred) {
+                return RibbonStep::Advanced;
+            }
+            if (front.next(nL) == tasks::RibbonFront::None ||
+                posR0 > streamList[strR].size() - 2) {
+                return RibbonStep::Done;
+            }
+            return RibbonStep::Neighbour;
+        }
 
-                float lDiag = euclidDist(l1, r0);
-                float rDiag = euclidDist(l0, r1);
-                float minDiag = std::min(lDiag, rDiag);
-                bool advanceOnLeft = (lDiag == minDiag);
+        // marks every ribbon finished, the surface stops where it is
+        static void finishFront(tasks::RibbonFront &front, unsigned int nStep) {
+            for (auto nL = front.first(); nL != tasks::RibbonFront::None; nL = front.next(nL)) {
+                front[nL].posL = nStep - 2;
+                front[nL].posR = nStep - 2;
+            }
+        }
 
-                if(posL0 > nStep - 1 || l0 == l1 || r0 == r1 || streamList.size() > 1000){// || posFront[nL][5] == 0) {
-                    // std::cout << "Finished" << nL << posFront[nL][0] << (l0 == l1) << (r0 == r1) << std::endl;
-                    posFront[nL][0] = nStep - 2;
-                    posFront[nL][1] = nStep - 2;
+        // Advances ribbon nL until its left side caught up with the right one.
+        // The ribbons waiting for their right neighbour to catch up are kept on
+        // an explicit stack, so long fronts do not recurse once per ribbon.
+        // Before every step the ribbon may swallow its right neighbour, rem
+        // counts the particles removed that way.
+        static void advanceRibbon(std::vector<std::vector<Point<3>>> &streamList,
+                                tasks::RibbonFront &front,
+                                std::string method,
+                                double& dStep,
+                                double& adStep,
+                                unsigned int& nStep,
+                                std::unique_ptr<tasks::VelocitySampler>& evaluator,
+                                tasks::RibbonFront::Handle nL, int& rem,
+                                tasks::SurfaceMesh &mesh,
+                                const Refinement &refine,
+                                const Budget &budget) {
+            if (nL == tasks::RibbonFront::None) {return;}
+            std::vector<RibbonTask> stack = {{nL, INFINITY, false}};
+            while (!stack.empty()) {
+                if (budget.exhausted(streamList.size(), mesh.triangles())) {
+                    finishFront(front, nStep);
                     return;
                 }
-                if(caughtUp && (advanceOnLeft || rDiag > prevDiag)) {    
-                    // std::cout << "Caught Up" << std::endl;
-                    return;
+                RibbonTask task = stack.back();
+                if (remParticle(streamList, front, mesh, task.nL, refine)) {
+                    task.prevDiag = INFINITY;
+                    rem++;
                 }
-                if (advanceOnLeft) {
-                    if (posFront[nL][5]) {
-                        makeTriangle(surfacePoints, 
-                                     surfaceIndexes, 
-                                     l0, r0, l1);
+                RibbonStep step = stepRibbon(streamList, front, method, dStep, adStep, nStep,
+                                             evaluator, task, mesh, refine,
+                                             budget.threshold(streamList.size(), mesh.triangles(), front.size()));
+                stack.back() = task;
+                if (step == RibbonStep::Done) {
+                    stack.pop_back();
+                } else if (step == RibbonStep::Neighbour) {
+                    stack.push_back({front.next(task.nL), INFINITY, false});
+                }
+            }
+        }
+
+        // Advances the whole front in rounds of chunk steps. Neighbouring
+        // ribbons share a streamline, so every round runs the even and then
+        // the odd ribbons, each half in parallel with its own sampler and
+        // triangle buffer per thread. On a closed front of odd length the last
+        // ribbon touches both halves and runs alone in a third phase.
+        // Particles found missing during a phase are inserted afterwards,
+        // worst first, and their ribbons go on in the next round; particles
+        // are removed in the same serial pass. The budget is checked between
+        // the phases.
+        static void advanceFrontParallel(std::vector<std::vector<Point<3>>> &streamList,
+                                         tasks::RibbonFront &front,
+                                         std::string method,
+                                         double dStep,
+                                         double adStep,
+                                         unsigned int nStep,
+                                         const tasks::FieldStorage &storage,
+                                         std::vector<std::unique_ptr<tasks::VelocitySampler>> &samplers,
+                                         std::unique_ptr<tasks::VelocitySampler>& evaluator,
+                                         tasks::SurfaceMesh &mesh,
+                                         const Refinement &refine, const Budget &budget, bool closed, int &rem) {
+            size_t chunk = 16;
+            size_t nThreads = samplers.size();
+            std::vector<tasks::SurfaceMesh> meshes(nThreads);
+            std::vector<std::vector<Insertion>> deferred(nThreads);
+            for (size_t target = chunk; ; target += chunk) {
+                bool open = false;
+                for (size_t parity = 0; parity < 3; parity++) {
+                    if (parity == 2 && !(closed && front.size() % 2)) continue;
+                    if (budget.exhausted(streamList.size(), mesh.triangles())) {
+                        finishFront(front, nStep);
+                        return;
                     }
-                    // std::cout << "Added Triangle L" << std::endl;
-                    if (streamList[strL].size() < nStep - 1
-                        && posL0 >= streamList[strL].size() - 2) {
-                        streamList[strL].push_back(makeStep(l1, method, dStep, adStep, evaluator));
+                    double threshold = budget.threshold(streamList.size(), mesh.triangles(), front.size());
+                    std::vector<tasks::RibbonFront::Handle> ribbons;
+                    size_t i = 0;
+                    for (auto nL = front.first(); nL != tasks::RibbonFront::None; nL = front.next(nL), i++) {
+                        // the last ribbon of an odd closed front shares a streamline with both the first and its left neighbour
+                        size_t colour = closed && front.size() % 2 && nL == front.last() ? 2 : i % 2;
+                        if (colour == parity && front[nL].posL < nStep - 2) ribbons.push_back(nL);
                     }
-                    posFront[nL][0]++;
-                    caughtUp = true;
-                } else {
-                    if (posFront[nL][5]) {
-                        makeTriangle(surfacePoints, 
-                                     surfaceIndexes, 
-                                     l0, r0, r1);
+                    open = open || !ribbons.empty();
+                    tasks::parallelForDynamic(0, ribbons.size(), 1, [&](size_t b, size_t e, size_t t) {
+                        if (!samplers[t]) samplers[t] = storage.makeSampler();
+                        // the adaptive Euler step changes these, every thread keeps its own
+                        double step = dStep, adaptive = adStep;
+                        unsigned int steps = nStep;
+                        for (size_t i = b; i < e; i++) {
+                            RibbonTask task = {ribbons[i], INFINITY, false};
+                            while (stepRibbon(streamList, front, method, step, adaptive, steps, samplers[t], task,
+                                              meshes[t], refine, threshold, target, &deferred[t]) != RibbonStep::Done) {
+                            }
+                        }
+                    });
+                    for (size_t t = 0; t < nThreads; t++) {
+                        mesh.append(meshes[t]);
+                        meshes[t].clear();
                     }
-                    // std::cout << "Added Triangle R" << nL << "immernoch < " << streamList.size() << std::endl;
-                    if (streamList[strR].size() < nStep - 1
-                        && posR0 >= streamList[strR].size() - 2) {
-                        streamList[strR].push_back(makeStep(r1, method, dStep, adStep, evaluator));
+                    std::vector<Insertion> insertions;
+                    for (size_t t = 0; t < nThreads; t++) {
+                        insertions.insert(insertions.end(), deferred[t].begin(), deferred[t].end());
+                        deferred[t].clear();
                     }
-                    posFront[nL][1]++;
-                    if (nL >= posFront.size() - 2 ||
-                        posR0 > streamList[strR].size() - 2) {
-                        // std::cout << "exiting" << std::endl;
-                        return;
+                    std::sort(insertions.begin(), insertions.end(), [](const Insertion &a, const Insertion &b) {
+                        return a.error > b.error;
+                    });
+                    for (Insertion &in : insertions) {
+                        tasks::Sample l0 = sample(front[in.nL].lineL, in.posL0);
+                        tasks::Sample r0 = sample(front[in.nL].lineR, in.posR0);
+                        if (addParticle(streamList, front, in.nL, in.posL0, in.posR0, in.l0, in.l1, in.r0, in.r1,
+                                        method, dStep, adStep, nStep, evaluator, refine,
+                                        budget.threshold(streamList.size(), mesh.triangles(), front.size()))) {
+                            mesh.add(l0, r0, sample(front[front.next(in.nL)].lineL, 0));
+                        }
+                    }
+                    for (auto nL = front.first(); nL != tasks::RibbonFront::None; nL = front.next(nL)) {
+                        while (remParticle(streamList, front, mesh, nL, refine)) rem++;
+                    }
+                }
+                if (!open) break;
+            }
+        }
+
+        // Traces the ribbon front of a seeded surface, ribbon by ribbon with
+        // sampler t or, with parallel, every other ribbon at a time on all
+        // cores.
+        static void makeRibbonSurface(Surface &s, std::string method, unsigned int nStep,
+                                      const tasks::FieldStorage &storage,
+                                      std::vector<std::unique_ptr<tasks::VelocitySampler>> &samplers,
+                                      bool parallel, const Refinement &refine, const Budget &budget,
+                                      size_t t = 0) {
+            std::vector<std::vector<Point<3>>> &streamList = s.streamList;
+            if (streamList.size() < 2) return;
+            // one ribbon between every two neighbouring streamlines
+            tasks::RibbonFront front;
+            for(size_t i = 0; i + 1 < streamList.size(); i++) {
+                front.pushBack({0, 0, (std::uint32_t) i, (std::uint32_t) i + 1, nStep, 1});
+            }
+            if (s.closed) {
+                front.pushBack({0, 0, (std::uint32_t) streamList.size() - 1, 0, nStep, 1});
+            }
+            if (!samplers[t]) samplers[t] = storage.makeSampler();
+            if (parallel) {
+                // the insertions between the phases are serial and take the first sampler
+                advanceFrontParallel(streamList, front, method, s.dStep, s.adStep, nStep, storage, samplers, samplers[t],
+                                     s.mesh, refine, budget, s.closed, s.rem);
+            } else {
+                //position marker for finished streamline
+                tasks::RibbonFront::Handle nL = front.first();
+                while((front[front.first()].posL < nStep - 2
+                    || front[front.last()].posR < nStep - 2)
+                    && nL != tasks::RibbonFront::None) {
+                    advanceRibbon(streamList, front, method, s.dStep, s.adStep, nStep, samplers[t], nL, s.rem, s.mesh, refine, budget);
+                    if(front[nL].posL >= nStep - 2) {
+                        nL = front.next(nL);
+                    }
+                }
+            }
+            s.left = front.size() + !s.closed;
+        }
+
+        // Timeline surface: every round advance(j, front, alive) moves the
+        // alive particles of the front from step j to j + 1, all by the same
+        // integration time, and returns false once none moved. The rows j and
+        // j + 1 are then zipped, two triangles per pair of neighbours, and a
+        // particle is inserted between two that drift further apart than twice
+        // the seed spacing, or more once the budget runs low. The front keeps
+        // seed curve order, line i begins at step first[i]; a closed front
+        // zips its last particle to the first as well.
+        template <typename Advance>
+        static void zipTimelines(unsigned int nStep, double spacing, bool closed,
+                                 std::vector<std::vector<Point<3>>> &streamList,
+                                 tasks::SurfaceMesh &mesh,
+                                 const Budget &budget,
+                                 Advance advance) {
+            std::vector<size_t> front;
+            std::vector<size_t> first(streamList.size(), 0);
+            // char rather than bool, the particles are advanced in parallel
+            std::vector<char> alive(streamList.size(), 1);
+            for (size_t i = 0; i < streamList.size(); i++) {
+                front.push_back(i);
+            }
+            auto has = [&](size_t i, size_t step) {
+                return step >= first[i] && step - first[i] < streamList[i].size();
+            };
+            for (size_t j = 0; j + 1 < nStep; j++) {
+                if (!advance(j, front, alive)) break;
+
+                if (budget.exhausted(streamList.size(), mesh.triangles())) break;
+                std::vector<size_t> refined;
+                for (size_t f = 0; f < front.size(); f++) {
+                    size_t l = front[f];
+                    refined.push_back(l);
+                    if (f + 1 == front.size() && !closed) break;
+                    size_t r = front[(f + 1) % front.size()];
+                    if (!has(l, j + 1) || !has(r, j + 1) || !has(l, j) || !has(r, j)) continue;
+                    Point<3> l1 = streamList[l][j + 1 - first[l]];
+                    Point<3> r1 = streamList[r][j + 1 - first[r]];
+                    mesh.add(sample(l, j - first[l]), sample(r, j - first[r]), sample(l, j + 1 - first[l]));
+                    mesh.add(sample(l, j + 1 - first[l]), sample(r, j - first[r]), sample(r, j + 1 - first[r]));
+                    if (euclidDist(l1, r1) > 2 * spacing * budget.threshold(streamList.size(), mesh.triangles(), front.size())) {
+                        streamList.push_back({l1 + ((r1 - l1) / 2)});
+                        first.push_back(j + 1);
+                        alive.push_back(1);
+                        refined.push_back(streamList.size() - 1);
+                    }
+                }
+                front.swap(refined);
+            }
+        }
+
+        // path surface: the particles of the start line advance together in
+        // time, so only the two fields around the current time are resident
+        static void makePathSurface(tasks::SliceStream &stream, std::string method,
+                                    double dStep, double dTime, unsigned int nStep, double spacing, bool closed,
+                                    std::vector<std::vector<Point<3>>> &streamList,
+                                    tasks::SurfaceMesh &mesh,
+                                    const Budget &budget) {
+            size_t perSlice = std::max<size_t>(1, (size_t) std::ceil(dTime / dStep));
+            double h = dTime / perSlice;
+            auto sampler = stream.makeSampler();
+            zipTimelines(nStep, spacing, closed, streamList, mesh, budget,
+                         [&](size_t j, const std::vector<size_t> &front, std::vector<char> &alive) {
+                if (!stream.load(j / perSlice)) return false;
+                double t0 = double(j % perSlice) / perSlice;
+                double t1 = double(j % perSlice + 1) / perSlice;
+                bool moved = false;
+                for (size_t i : front) {
+                    if (!alive[i]) continue;
+                    Point<3> next;
+                    if (tasks::pathStep(*sampler, streamList[i].back(), t0, t1, h, method == "Runge-Kutta", next)) {
+                        streamList[i].push_back(next);
+                        moved = true;
+                    } else {
+                        alive[i] = 0;
                     }
-                    advanceRibbon(streamList, 
-                                  posFront, method, dStep, adStep, nStep, 
-                                  evaluator,
-                                  nL + 1, rem,
-                                  surfacePoints,
-                                  surfaceIndexes);
                 }
-                prevDiag = minDiag;
+                return moved;
+            });
+        }
+
+        // one step of fixed length h through the steady field, so all
+        // particles of a timeline stay at the same integration time
+        static bool timelineStep(tasks::VelocitySampler &sampler, const Point<3> &p, double h,
+                                 bool rungeKutta, Point<3> &next) {
+            if (!sampler.reset(p)) return false;
+            Vector3 k1 = sampler.value();
+            if (k1[0] == 0 && k1[1] == 0 && k1[2] == 0) return false;
+            if (!rungeKutta) {
+                next = p + h * k1;
+                return sampler.reset(next);
             }
-            return;
+            if (!sampler.reset(p + 0.5 * h * k1)) return false;
+            Vector3 k2 = sampler.value();
+            if (!sampler.reset(p + 0.5 * h * k2)) return false;
+            Vector3 k3 = sampler.value();
+            if (!sampler.reset(p + h * k3)) return false;
+            Vector3 k4 = sampler.value();
+            next = p + h / 6.0 * (k1 + 2.0 * k2 + 2.0 * k3 + k4);
+            return sampler.reset(next);
+        }
+
+        // timelines through the steady field: each round is one batch over
+        // the whole front, spread over all cores with one of the samplers per
+        // thread
+        static void makeTimelineSurface(const tasks::FieldStorage &storage,
+                                        std::vector<std::unique_ptr<tasks::VelocitySampler>> &samplers,
+                                        std::string method,
+                                        double dStep, unsigned int nStep, double spacing, bool closed,
+                                        std::vector<std::vector<Point<3>>> &streamList,
+                                        tasks::SurfaceMesh &mesh,
+                                        const Budget &budget) {
+            size_t nThreads = samplers.size();
+            bool rungeKutta = method == "Runge-Kutta";
+            zipTimelines(nStep, spacing, closed, streamList, mesh, budget,
+                         [&](size_t, const std::vector<size_t> &front, std::vector<char> &alive) {
+                std::vector<char> moved(nThreads, 0);
+                tasks::parallelForDynamic(0, front.size(), 64, [&](size_t b, size_t e, size_t t) {
+                    if (!samplers[t]) samplers[t] = storage.makeSampler();
+                    for (size_t f = b; f < e; f++) {
+                        size_t i = front[f];
+                        if (!alive[i]) continue;
+                        Point<3> next;
+                        if (timelineStep(*samplers[t], streamList[i].back(), dStep, rungeKutta, next)) {
+                            streamList[i].push_back(next);
+                            moved[t] = 1;
+                        } else {
+                            alive[i] = 0;
+                        }
+                    }
+                });
+                return std::find(moved.begin(), moved.end(), 1) != moved.end();
+            });
         }
 
         static std::shared_ptr<graphics::Drawable> drawLines(std::vector<PointF<3>> pointsFList,std::vector<VectorF<3>> vertices, Color color)
@@ -365,13 +879,18 @@ namespace
             return graphic;
         }
 
-        static std::shared_ptr<graphics::Drawable> drawSurface(std::vector<PointF<3>> points, std::vector<unsigned int> indexes, Color color) {
+        // vertices per surface chunk, so the indexes of a chunk fit 16 bits
+        // with 0xFFFF left free as the restart index
+        static constexpr size_t chunkVertices = 65535;
+
+        // one chunk of a surface with the normals from SurfaceMesh::buildChunks
+        static std::shared_ptr<graphics::Drawable> drawSurface(const std::vector<PointF<3>> &points,
+                                                               const std::vector<VectorF<3>> &norm,
+                                                               const std::vector<std::uint16_t> &indexes, Color color) {
             auto const &system = graphics::GraphicsSystem::instance(); // The GraphicsSystem is needed to create Drawables, which represent the to be rendererd objects.
             std::string resourcePath = PluginRegistrationService::getInstance().getResourcePath("utils/Graphics"); // path to the shaders
             // The BoundingSphere should contain all elements of the drawable and is needed for its creation.
             auto bs = graphics::computeBoundingSphere(points);
-            // For the used Phong-Shading, the calculation of surface normals is necessary.
-            auto norm = graphics::computeNormals(points, indexes);
             // The Drawable object defines the input streams for the shaders.
             // Vertex- and IndexBuffers as well as Uniforms can be defined as seen below.
             std::shared_ptr< graphics::Drawable> graphic = 
@@ -401,10 +920,119 @@ namespace
             double dStep = options.get<double>("dStep");
             double adStep = options.get<double>("adStep");
             unsigned int nStep = options.get<size_t>("nStep") + 1;
+            Refinement refine = {options.get<double>("Max aspect"),
+                                 options.get<double>("Front angle") * M_PI / 180,
+                                 options.get<double>("Surface angle") * M_PI / 180,
+                                 options.get<double>("Merge ratio")};
+            Budget budget = {options.get<size_t>("Max particles"),
+                             options.get<size_t>("Max triangles"),
+                             options.get<size_t>("Max memory") << 20};
             Color colorStartLine = options.get<Color>("colorStartLine");
             Color colorStream = options.get<Color>("colorStream");
             Color colorSurface = options.get<Color>("colorSurface");
-            
+
+            // the curves the particles start on, seeds no more than dStep apart along each
+            std::string curveKind = options.get<std::string>("Seed curve");
+            std::vector<tasks::SeedCurve> curves;
+            if (curveKind == "Grid lines") {
+                std::shared_ptr<const Grid<3>> seedGrid = options.get<Grid<3>>("Seed grid");
+                if (seedGrid) curves = tasks::gridCurves(*seedGrid);
+            } else if (!options.get<std::string>("Seed lines").empty()) {
+                curves = tasks::parseSeedCurves(curveKind, options.get<std::string>("Seed lines"),
+                                                options.get<bool>("Closed"), options.get<std::string>("Curve normal"));
+            } else {
+                curves.push_back(tasks::makeSeedCurve(curveKind, startcoord, endcoord,
+                                                      options.get<std::string>("Curve points"),
+                                                      options.get<bool>("Closed"),
+                                                      options.get<std::string>("Curve normal")));
+            }
+            curves.erase(std::remove_if(curves.begin(), curves.end(), [](const tasks::SeedCurve &curve) {
+                return !(curve.length() > 0);
+            }), curves.end());
+            if (curves.empty()) {
+                debugLog() << "The seed curve is empty." << std::endl;
+                return;
+            }
+            if (curves.size() > 1) {
+                debugLog() << curves.size() << " seed curves, one surface each" << std::endl;
+            }
+            std::vector<Surface> surfaces(curves.size());
+            std::vector<std::vector<double>> fractions(curves.size());
+            for (size_t k = 0; k < curves.size(); k++) {
+                fractions[k] = curves[k].fractions(dStep);
+                surfaces[k].spacing = curves[k].length() / (curves[k].closed() ? fractions[k].size() : fractions[k].size() - 1);
+                surfaces[k].dStep = dStep;
+                surfaces[k].adStep = adStep;
+            }
+            // "surface k: " in front of the log lines of a batch
+            auto label = [&](size_t k) {
+                std::ostringstream s;
+                if (surfaces.size() > 1) s << "surface " << k << ": ";
+                return s.str();
+            };
+
+            // the triangles stream into the file as they are made, the streamlines follow at the end
+            std::unique_ptr<tasks::MeshWriter> writer;
+            bool exportOnly = false;
+            if (!options.get<std::string>("Export file").empty()) {
+                writer.reset(new tasks::MeshWriter(options.get<std::string>("Export file"), options.get<std::string>("Export format")));
+                if (!writer->good()) {
+                    debugLog() << "cannot write " << options.get<std::string>("Export file") << std::endl;
+                    writer.reset();
+                } else {
+                    exportOnly = options.get<bool>("Export only");
+                    for (Surface &s : surfaces) {
+                        s.mesh.streamTo(writer.get(), &s.streamList, !exportOnly);
+                    }
+                }
+            }
+            auto finish = [&]() {
+                if (writer) {
+                    for (Surface &s : surfaces) {
+                        s.mesh.finishStream();
+                    }
+                    writer->close();
+                    debugLog() << writer->describe() << std::endl;
+                }
+                draw(curves, surfaces, options.get<bool>("Surface colours"), options.get<std::string>("Level of detail"),
+                     exportOnly, colorStartLine, colorStream, colorSurface);
+            };
+
+            if (options.get<bool>("Path surface")) {
+                std::string error;
+                std::unique_ptr<tasks::SliceStream> stream = tasks::openSeries(
+                    options.get<std::string>("Time series files"), options.get<Function<Vector3>>("Field"),
+                    options.get<DataObjectBundle>("Time series"), options.get<std::string>("Storage"),
+                    options.get<bool>("Prefetch"), error);
+                if (!stream) {
+                    debugLog() << "Path surfaces: " << error << "." << std::endl;
+                    return;
+                }
+                if (options.get<std::string>("Importance") != "Off") {
+                    debugLog() << "importance seeding needs the steady field, the path surface starts evenly spaced" << std::endl;
+                }
+                // the surfaces share the stream, the series is loaded again for every one
+                for (size_t k = 0; k < surfaces.size(); k++) {
+                    Surface &s = surfaces[k];
+                    for (double u : fractions[k]) {
+                        s.streamList.push_back({curves[k].at(u)});
+                    }
+                    s.closed = curves[k].closed();
+                    try {
+                        makePathSurface(*stream, method, dStep, options.get<double>("dTime"), nStep, s.spacing,
+                                        s.closed, s.streamList, s.mesh, budget);
+                    } catch (const std::runtime_error &e) {
+                        // a time series file that cannot be read
+                        debugLog() << "Path surfaces: " << e.what() << std::endl;
+                        return;
+                    }
+                    debugLog() << label(k) << budget.describe(s.streamList.size(), s.mesh.triangles()) << std::endl;
+                }
+                debugLog() << stream->describe() << std::endl;
+                finish();
+                return;
+            }
+
             std::shared_ptr<const Field<3, Vector3>> field = options.get<Field<3, Vector3>>("Field");
             std::shared_ptr<const Function<Vector3>> function = options.get<Function<Vector3>>("Field");
 
@@ -420,83 +1048,182 @@ namespace
                 throw std::logic_error("Wrong type of grid!");
             }
 
-            auto evaluator = field->makeEvaluator();
-            
-            //make vectors for startline
-            std::vector<PointF<3>> startPoints = {(PointF<3>)startcoord, (PointF<3>)endcoord};
-            std::vector<VectorF<3>> startVectors = {(VectorF<3>)startcoord, (VectorF<3>)endcoord};
+            tasks::FieldStorage storage(field, function,
+                                        options.get<std::string>("Storage"));
+            debugLog() << storage.describe() << std::endl;
+            if (options.get<bool>("Compare storage") && storage.ownInterpolation()) {
+                debugLog() << storage.describe(storage.compare()) << std::endl;
+            }
+            size_t cacheSize = options.get<size_t>("Cache size");
+            if (!storage.useCache(cacheSize, options.get<double>("Cache tolerance"))) {
+                debugLog() << "sample cache needs a lattice or compressed storage, tracing without it" << std::endl;
+            }
+            auto evaluator = storage.makeSampler();
+            // one sampler per thread, shared by all surfaces of the batch
+            std::vector<std::unique_ptr<tasks::VelocitySampler>> samplers(tasks::numThreads());
 
-            //start by making points from start to end coordinates
-            // amount of lines in first step
-            size_t nTracer = euclidDist(startcoord, endcoord) / dStep + 1;
-            std::vector<std::vector<Point<3>>> streamList;
+            // with importance the particles crowd where the feature along the seed curve is strong
+            std::string feature = options.get<std::string>("Importance");
+            std::shared_ptr<const Field<3, Scalar>> scalar = options.get<Field<3, Scalar>>("Importance scalar");
+            for (size_t k = 0; k < surfaces.size(); k++) {
+                Surface &s = surfaces[k];
+                const tasks::SeedCurve &curve = curves[k];
+                std::unique_ptr<tasks::ImportanceTable> table;
+                if (feature != "Off") {
+                    size_t nSamples = 8 * fractions[k].size();
+                    table.reset(new tasks::ImportanceTable(nSamples, [&](size_t i) {
+                        return curve.at((i + 0.5) / nSamples);
+                    }, [&]() {
+                        return tasks::FeatureProbe(feature, storage.makeSampler(), scalar ? scalar->makeEvaluator() : nullptr, dStep);
+                    }));
+                    debugLog() << label(k) << table->describe() << std::endl;
+                }
 
-            for(size_t i = 0; i <= nTracer; i++) {
-                Point<3> p = startcoord + i * ((endcoord - startcoord) / nTracer);
-                if (!(evaluator->reset(p))) continue;
-                std::vector<Point<3>> oneTracerPoints;
-                oneTracerPoints.push_back(p);
-                for ( size_t j = 0; j < 1; j++) {
-                    oneTracerPoints.push_back(makeStep(oneTracerPoints[j], method, dStep, adStep, evaluator));
+                for (double u : fractions[k]) {
+                    if (table && !table->empty()) u = table->quantile(u);
+                    Point<3> p = curve.at(u);
+                    if (!(evaluator->reset(p))) continue;
+                    std::vector<Point<3>> oneTracerPoints;
+                    oneTracerPoints.push_back(p);
+                    for ( size_t j = 0; j < 1; j++) {
+                        oneTracerPoints.push_back(makeStep(oneTracerPoints[j], method, s.dStep, s.adStep, evaluator));
+                    }
+                    s.streamList.push_back(oneTracerPoints);
+                }
+                // a closed curve closes the surface unless a seed left the field
+                s.closed = curve.closed() && s.streamList.size() == fractions[k].size();
+            }
+
+            if (options.get<bool>("Timelines")) {
+                for (size_t k = 0; k < surfaces.size(); k++) {
+                    Surface &s = surfaces[k];
+                    // the rows start at the seeds, the first step is taken in sync
+                    for (auto &line : s.streamList) {
+                        line.resize(1);
+                    }
+                    if (s.streamList.size() > 1) {
+                        // the seeding steps above may have changed dStep adaptively
+                        makeTimelineSurface(storage, samplers, method, dStep, nStep, s.spacing, s.closed,
+                                            s.streamList, s.mesh, budget);
+                    }
+                    debugLog() << label(k) << budget.describe(s.streamList.size(), s.mesh.triangles()) << std::endl;
+                }
+                finish();
+                return;
+            }
+            if (options.get<bool>("Parallel")) {
+                // every surface in turn on all cores
+                for (Surface &s : surfaces) {
+                    makeRibbonSurface(s, method, nStep, storage, samplers, true, refine, budget);
                 }
-                streamList.push_back(oneTracerPoints);
-            }
-            nTracer = streamList.size();
-            //std::set<PointF<3>> surfacePointsSet;
-            std::vector<PointF<3>> surfacePoints;
-            std::vector<unsigned int> surfaceIndexes;
-            std::vector<std::vector<size_t>> posFront;
-            /* posFront describes:
-            0,1: Position on left and right Streamline
-            2,3: Position of left and right Streamline vector in Streamlist
-            4: Amount of Points to be drawn 
-            5: 0 if ripped 1 otherwise*/
-            for(size_t i = 0; i < streamList.size(); i++) {
-                posFront.push_back({0,0,i,i+1,nStep,1});
-            }
-            //advanceRibbonSimp(streamList, posFront, 0, surfacePoints, surfaceIndexes);
-            //position marker for finished streamline
-            size_t nL = 0;
-            int rem = 0;
-            std::cout << streamList.size() << std::endl;
-            std::cout << nTracer << std::endl;
-            if (streamList.size() > 1){
-                while((posFront[0][0] < nStep - 2
-                    || posFront[posFront.size()-2][1] < nStep - 2) 
-                    // && streamList.size() < 1000
-                    && nL <= posFront.size() - 2) {
-                    advanceRibbon(streamList, posFront, method, dStep, adStep, nStep, evaluator, nL, rem, surfacePoints, surfaceIndexes);
-                    if(posFront[nL][0] >= nStep - 2) {
-                        nL++;
+            } else {
+                // one surface per core at a time
+                tasks::parallelForDynamic(0, surfaces.size(), 1, [&](size_t b, size_t e, size_t t) {
+                    for (size_t k = b; k < e; k++) {
+                        makeRibbonSurface(surfaces[k], method, nStep, storage, samplers, false, refine, budget, t);
                     }
-                    // std::cout << nL << std::endl;
+                });
+            }
+            for (size_t k = 0; k < surfaces.size(); k++) {
+                const Surface &s = surfaces[k];
+                if (s.rem) {
+                    debugLog() << label(k) << s.rem << " particles removed, " << s.left << " left on the front" << std::endl;
                 }
+                debugLog() << label(k) << budget.describe(s.streamList.size(), s.mesh.triangles()) << std::endl;
             }
-            // advanceRibbon(streamList, posFront, method, dStep, adStep, nStep, evaluator, nL, rem, surfacePoints, surfaceIndexes);
-            std::cout << streamList.size() << std::endl;
-            std::cout << nTracer << std::endl;
 
-            // convert set to vector
-            // std::vector<PointF<3>> surfacePoints(surfacePointsSet.begin(), surfacePointsSet.end());
+            if (cacheSize && storage.ownInterpolation()) {
+                debugLog() << storage.describeCache() << std::endl;
+            }
+
+            finish();
+        }
+
+        // the colour of surface k of a batch, the first one keeps colorSurface
+        static Color surfaceColor(size_t k, Color first) {
+            static const Color palette[] = {Color(0.12, 0.47, 0.71), Color(1.0, 0.5, 0.05), Color(0.84, 0.15, 0.16),
+                                            Color(0.58, 0.4, 0.74), Color(0.55, 0.34, 0.29), Color(0.89, 0.47, 0.76),
+                                            Color(0.5, 0.5, 0.5), Color(0.74, 0.74, 0.13), Color(0.09, 0.75, 0.81)};
+            return k ? palette[(k - 1) % (sizeof(palette) / sizeof(palette[0]))] : first;
+        }
+
+        // Seed curves, streamlines and surfaces of all surfaces as one
+        // drawable each, the surface one a compound of the chunks. With
+        // colours every surface gets a colour of its own. Exported only,
+        // streamlines and surfaces are left to the file.
+        void draw(const std::vector<tasks::SeedCurve> &curves,
+                  const std::vector<Surface> &surfaces,
+                  bool colours, const std::string &detail, bool exportOnly,
+                  Color colorStartLine, Color colorStream, Color colorSurface) {
+            //make vectors for the seed curves, two points per segment
+            std::vector<Point<3>> segments;
+            for (const tasks::SeedCurve &curve : curves) {
+                curve.outline(segments);
+            }
+            std::vector<PointF<3>> startPoints;
+            std::vector<VectorF<3>> startVectors;
+            for (const Point<3> &p : segments) {
+                startPoints.push_back((PointF<3>) p);
+                startVectors.push_back((VectorF<3>) p);
+            }
 
             // preparing points to draw streamLines
             std::vector<PointF<3>> streamPoints;
             std::vector<VectorF<3>> streamVectors;
-            for (size_t i = 0; i < streamList.size(); i++) {
-                for (size_t j = 0; j < streamList[i].size(); j++) {
-                    if (streamList[i].size() < 2) break;
-                    streamPoints.push_back((PointF<3>) streamList[i][j]);
-                    if (j!= 0 && j != streamList[i].size() - 1) {
+            for (const Surface &s : surfaces) {
+                if (exportOnly) break;
+                const std::vector<std::vector<Point<3>>> &streamList = s.streamList;
+                for (size_t i = 0; i < streamList.size(); i++) {
+                    for (size_t j = 0; j < streamList[i].size(); j++) {
+                        if (streamList[i].size() < 2) break;
+                        streamPoints.push_back((PointF<3>) streamList[i][j]);
+                        if (j!= 0 && j != streamList[i].size() - 1) {
+                            streamVectors.push_back((VectorF<3>) streamList[i][j]);
+                        }
                         streamVectors.push_back((VectorF<3>) streamList[i][j]);
                     }
-                    streamVectors.push_back((VectorF<3>) streamList[i][j]);
                 }
             }
-            
+
+            // One vertex per streamline point on a surface, shared by its
+            // triangles. The surfaces are uploaded in chunks of their own
+            // bounding sphere, only one chunk is kept in memory at a time.
+            std::vector<std::shared_ptr<graphics::Drawable>> parts;
+            std::vector<double> levels = tasks::detailLevels(detail);
+            for (size_t k = 0; k < surfaces.size() && !exportOnly; k++) {
+                Color color = colours && surfaces.size() > 1 ? surfaceColor(k, colorSurface) : colorSurface;
+                // the chunk is released as soon as its buffers are made
+                auto upload = [&](const std::vector<PointF<3>> &points,
+                                  const std::vector<VectorF<3>> &normals,
+                                  const std::vector<std::uint16_t> &indexes) {
+                    parts.push_back(drawSurface(points, normals, indexes, color));
+                };
+                if (levels.empty()) {
+                    surfaces[k].mesh.buildChunks(surfaces[k].streamList, chunkVertices, upload);
+                    continue;
+                }
+                // a coarser level needs the whole mesh, each level is decimated from the one before
+                std::vector<PointF<3>> points;
+                std::vector<unsigned int> indexes;
+                surfaces[k].mesh.build(surfaces[k].streamList, points, indexes);
+                size_t full = indexes.size() / 3;
+                double fullArea = tasks::meshArea(points, indexes);
+                for (double ratio : levels) {
+                    tasks::decimateMesh(points, indexes, (size_t) (ratio * full));
+                    debugLog() << (surfaces.size() > 1 ? "surface " + std::to_string(k) + ": " : "")
+                               << tasks::describeDetail(ratio, indexes.size() / 3, full,
+                                                        tasks::meshArea(points, indexes), fullArea) << std::endl;
+                }
+                tasks::chunkMesh(points, indexes, chunkVertices, upload);
+            }
+            if (parts.empty()) {
+                parts.push_back(drawSurface({}, {}, {}, colorSurface));
+            }
+
             // making the visualization
             std::shared_ptr<graphics::Drawable> startLine = drawLines(startPoints, startVectors, colorStartLine);
             std::shared_ptr<graphics::Drawable> streamlines = drawLines(streamPoints, streamVectors, colorStream);
-            std::shared_ptr<graphics::Drawable> surface = drawSurface(surfacePoints, surfaceIndexes, colorSurface);
+            std::shared_ptr<graphics::Drawable> surface = parts.size() == 1 ? parts[0] : graphics::makeCompound(parts);
             setGraphics("startline", startLine);   
             setGraphics("streamlines", streamlines);
             setGraphics("surface", surface);
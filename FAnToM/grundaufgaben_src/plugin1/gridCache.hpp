@@ -0,0 +1,33 @@
+#pragma once
+
+#include <fantom/dataset.hpp>
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+namespace tasks
+{
+    using namespace fantom;
+
+    // keeps one T per grid, keyed by grid identity. The grid is only held weakly,
+    // entries of grids that no longer exist are dropped on the next lookup.
+    // built tells whether build() had to run.
+    template <typename T, typename Build>
+    std::shared_ptr<const T> cachedForGrid(const std::shared_ptr<const Grid<3>> &grid, Build build, bool &built) {
+        static std::mutex mutex;
+        static std::map<const Grid<3> *, std::pair<std::weak_ptr<const Grid<3>>, std::shared_ptr<const T>>> cache;
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto it = cache.begin(); it != cache.end();) {
+            if (it->second.first.expired()) it = cache.erase(it);
+            else it++;
+        }
+        auto it = cache.find(grid.get());
+        built = it == cache.end();
+        if (!built) return it->second.second;
+        std::shared_ptr<const T> value = build();
+        cache[grid.get()] = std::make_pair(std::weak_ptr<const Grid<3>>(grid), value);
+        return value;
+    }
+}
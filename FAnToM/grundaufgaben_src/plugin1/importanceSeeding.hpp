@@ -0,0 +1,268 @@
+#pragma once
+
+#include "parallel.hpp"
+#include "seedGenerators.hpp"
+#include "velocitySampler.hpp"
+
+#include <fantom/dataset.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace tasks
+{
+    using namespace fantom;
+
+    inline std::vector<std::string> featureChoices() {
+        return {"Off", "Speed", "Vorticity", "Divergence", "Scalar"};
+    }
+
+    // the feature measure at single points. Vorticity is the curl and
+    // divergence the trace of the Jacobian, both by central differences of
+    // width 2h, the scalar is taken by its magnitude. Not thread safe, every
+    // thread needs its own.
+    class FeatureProbe
+    {
+    public:
+        FeatureProbe(const std::string &feature, std::unique_ptr<VelocitySampler> sampler,
+                     std::unique_ptr<FieldEvaluator<3UL, Scalar>> scalar, double h)
+            : feature(feature), sampler(std::move(sampler)), scalar(std::move(scalar)), h(h)
+        {
+        }
+
+        // false where the measure is not defined
+        bool measure(const Point3 &p, double &m) {
+            if (feature == "Scalar") {
+                if (!scalar || !scalar->reset(p)) return false;
+                m = std::abs(scalar->value()[0]);
+                return true;
+            }
+            if (!sampler->reset(p)) return false;
+            Vector3 v = sampler->value();
+            if (feature != "Vorticity" && feature != "Divergence") {
+                m = norm(v);
+                return true;
+            }
+            // du[a][b] is the derivative of component b along axis a, one sided at the boundary
+            double du[3][3];
+            for (size_t a = 0; a < 3; a++) {
+                Point3 q0 = p, q1 = p;
+                q0[a] -= h;
+                q1[a] += h;
+                Vector3 v0 = v, v1 = v;
+                double width = 0.0;
+                if (sampler->reset(q0)) {
+                    v0 = sampler->value();
+                    width += h;
+                }
+                if (sampler->reset(q1)) {
+                    v1 = sampler->value();
+                    width += h;
+                }
+                for (size_t b = 0; b < 3; b++) {
+                    du[a][b] = width > 0.0 ? (v1[b] - v0[b]) / width : 0.0;
+                }
+            }
+            if (feature == "Divergence") {
+                m = std::abs(du[0][0] + du[1][1] + du[2][2]);
+                return true;
+            }
+            double wx = du[1][2] - du[2][1];
+            double wy = du[2][0] - du[0][2];
+            double wz = du[0][1] - du[1][0];
+            m = std::sqrt(wx * wx + wy * wy + wz * wz);
+            return true;
+        }
+
+    private:
+        std::string feature;
+        std::unique_ptr<VelocitySampler> sampler;
+        std::unique_ptr<FieldEvaluator<3UL, Scalar>> scalar;
+        double h;
+    };
+
+    // Cumulative feature measure over a set of points, the probability of a
+    // point is its share of the total. The measure is evaluated once per point
+    // in a single parallel pass with a running sum per thread block, the block
+    // totals are then added as offsets. Every defined point gets floor times the
+    // mean measure on top, so calm regions are not left out entirely.
+    class ImportanceTable
+    {
+    public:
+        // point(i) gives the i-th point, makeProbe() a FeatureProbe for one thread
+        template <typename PointAt, typename MakeProbe>
+        ImportanceTable(size_t n, PointAt point, MakeProbe makeProbe, double floor = 0.1)
+            : cdf(n), defined(0)
+        {
+            size_t nThreads = numThreads();
+            std::vector<double> blockSum(nThreads, 0.0);
+            std::vector<size_t> blockDefined(nThreads, 0);
+            std::vector<Point3> blockLo(nThreads), blockHi(nThreads);
+            double inf = std::numeric_limits<double>::infinity();
+
+            // measure, negative where undefined, and the per block sums
+            parallelFor(0, n, [&](size_t b, size_t e, size_t t) {
+                FeatureProbe probe = makeProbe();
+                Point3 lo(inf, inf, inf), hi(-inf, -inf, -inf);
+                double sum = 0.0;
+                size_t count = 0;
+                for (size_t i = b; i < e; i++) {
+                    Point3 p = point(i);
+                    double m;
+                    if (!probe.measure(p, m) || !(m >= 0.0) || std::isinf(m)) {
+                        cdf[i] = -1.0;
+                        continue;
+                    }
+                    cdf[i] = m;
+                    sum += m;
+                    count++;
+                    for (size_t d = 0; d < 3; d++) {
+                        lo[d] = std::min(lo[d], p[d]);
+                        hi[d] = std::max(hi[d], p[d]);
+                    }
+                }
+                blockSum[t] = sum;
+                blockDefined[t] = count;
+                blockLo[t] = lo;
+                blockHi[t] = hi;
+            });
+
+            double raw = 0.0;
+            lo = Point3(inf, inf, inf);
+            hi = Point3(-inf, -inf, -inf);
+            for (size_t t = 0; t < nThreads; t++) {
+                raw += blockSum[t];
+                defined += blockDefined[t];
+                for (size_t d = 0; d < 3; d++) {
+                    lo[d] = std::min(lo[d], blockLo[t][d]);
+                    hi[d] = std::max(hi[d], blockHi[t][d]);
+                }
+            }
+            if (!defined) return;
+            // a field that is zero everywhere still gets uniform seeds
+            double extra = raw > 0.0 ? floor * raw / defined : 1.0;
+            std::vector<double> offset(nThreads, 0.0);
+            for (size_t t = 1; t < nThreads; t++) {
+                offset[t] = offset[t - 1] + blockSum[t - 1] + extra * blockDefined[t - 1];
+            }
+            mean = raw / defined;
+
+            // same blocks as above, so block t starts at offset[t]
+            parallelFor(0, n, [&](size_t b, size_t e, size_t t) {
+                double sum = offset[t];
+                for (size_t i = b; i < e; i++) {
+                    if (cdf[i] >= 0.0) sum += cdf[i] + extra;
+                    cdf[i] = sum;
+                }
+            });
+        }
+
+        size_t size() const {
+            return cdf.size();
+        }
+
+        bool empty() const {
+            return !defined;
+        }
+
+        double total() const {
+            return cdf.empty() ? 0.0 : cdf.back();
+        }
+
+        // the point whose share of the total contains u * total, u in [0, 1)
+        size_t sample(double u) const {
+            auto it = std::upper_bound(cdf.begin(), cdf.end(), u * total());
+            return std::min<size_t>(it - cdf.begin(), cdf.size() - 1);
+        }
+
+        // Inverse of the cumulative measure with the points taken as the n
+        // equal pieces of [0, 1] in order, e.g. the segments of a curve. Spacing
+        // the u evenly gives samples that are dense where the measure is high.
+        double quantile(double u) const {
+            if (cdf.empty()) return u;
+            double target = u * total();
+            size_t i = sample(u);
+            double prev = i > 0 ? cdf[i - 1] : 0.0;
+            double frac = cdf[i] > prev ? (target - prev) / (cdf[i] - prev) : 0.0;
+            return (i + std::min(1.0, std::max(0.0, frac))) / cdf.size();
+        }
+
+        const Point3 &lower() const {
+            return lo;
+        }
+
+        const Point3 &upper() const {
+            return hi;
+        }
+
+        std::string describe() const {
+            std::ostringstream s;
+            s << "importance seeding: " << defined << " of " << cdf.size() << " points defined, mean measure " << mean;
+            return s.str();
+        }
+
+    private:
+        std::vector<double> cdf;
+        size_t defined;
+        double mean = 0.0;
+        Point3 lo, hi;
+    };
+
+    // count random points drawn from the table, each moved randomly by up to
+    // half of jitter per axis so repeated picks of one node do not trace the
+    // same line twice
+    template <typename PointAt>
+    class ImportanceSeeds : public SeedGenerator
+    {
+    public:
+        ImportanceSeeds(std::shared_ptr<const ImportanceTable> table, PointAt point,
+                        size_t count, double jitter, unsigned int seed = 0)
+            : table(std::move(table)), point(point), count(count), jitter(jitter),
+              rng(seed), unit(0.0, 1.0)
+        {
+        }
+
+        bool next(Point3 &p) override {
+            if (!count || table->empty()) return false;
+            p = point(table->sample(unit(rng)));
+            for (size_t d = 0; d < 3; d++) {
+                p[d] += (unit(rng) - 0.5) * jitter;
+            }
+            count--;
+            return true;
+        }
+
+        void outline(std::vector<Point3> &segments) const override {
+            if (!table->empty()) boxOutline(table->lower(), table->upper(), segments);
+        }
+
+    private:
+        std::shared_ptr<const ImportanceTable> table;
+        PointAt point;
+        size_t count;
+        double jitter;
+        std::mt19937 rng;
+        std::uniform_real_distribution<double> unit;
+    };
+
+    // typical node distance of n points spread over the table's box
+    inline double nodeSpacing(const ImportanceTable &table) {
+        if (table.empty()) return 0.0;
+        Vector3 size = table.upper() - table.lower();
+        double volume = 1.0;
+        size_t dims = 0;
+        for (size_t d = 0; d < 3; d++) {
+            if (size[d] > 0.0) {
+                volume *= size[d];
+                dims++;
+            }
+        }
+        return dims ? std::pow(volume / table.size(), 1.0 / dims) : 0.0;
+    }
+}
@@ -0,0 +1,241 @@
+#pragma once
+
+#include <fantom/dataset.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <glob.h>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace tasks
+{
+    using namespace fantom;
+
+    // the files of a list separated by semicolons, every entry may be a
+    // wildcard pattern that expands to its matches in sorted order
+    inline std::vector<std::string> expandFileList(const std::string &list) {
+        std::vector<std::string> files;
+        std::istringstream entries(list);
+        std::string entry;
+        while (std::getline(entries, entry, ';')) {
+            size_t b = entry.find_first_not_of(" \t\r\n");
+            if (b == std::string::npos) continue;
+            entry = entry.substr(b, entry.find_last_not_of(" \t\r\n") - b + 1);
+            glob_t matches;
+            if (glob(entry.c_str(), 0, nullptr, &matches) == 0) {
+                for (size_t i = 0; i < matches.gl_pathc; i++) {
+                    files.push_back(matches.gl_pathv[i]);
+                }
+            } else {
+                // no match, the reader reports the missing file
+                files.push_back(entry);
+            }
+            globfree(&matches);
+        }
+        return files;
+    }
+
+    // Reads the point vectors of a legacy VTK file, the first VECTORS of the
+    // POINT_DATA or else its first FIELD array with three components. The
+    // dataset itself is skipped, the caller already has the grid. Binary files
+    // are big endian as the format prescribes.
+    class LegacyVtkVectors
+    {
+    public:
+        static void read(const std::string &path, size_t count, std::vector<Vector3> &values) {
+            LegacyVtkVectors reader(path);
+            reader.readFile(count, values);
+        }
+
+    private:
+        explicit LegacyVtkVectors(const std::string &path)
+            : path(path), file(std::fopen(path.c_str(), "rb"), &std::fclose)
+        {
+            if (!file) fail("cannot open the file");
+        }
+
+        void readFile(size_t count, std::vector<Vector3> &values) {
+            std::vector<std::string> header = line();
+            if (header.size() < 2 || header[0] != "#" || upper(header[1]) != "VTK") fail("not a legacy VTK file");
+            std::fgets(buffer, sizeof(buffer), file.get());  // the title
+            std::vector<std::string> format = line();
+            if (format.empty()) fail("no ASCII or BINARY line");
+            binary = upper(format[0]) == "BINARY";
+
+            bool pointData = false;
+            size_t n = 0;
+            for (std::vector<std::string> words = line(); !words.empty(); words = line()) {
+                std::string key = upper(words[0]);
+                if (key == "POINT_DATA" || key == "CELL_DATA") {
+                    pointData = key == "POINT_DATA";
+                    n = number(words, 1);
+                    if (pointData && n != count) {
+                        fail("has " + std::to_string(n) + " point values, the grid " + std::to_string(count) + " points");
+                    }
+                } else if (key == "VECTORS" && pointData) {
+                    readVectors(values, count, type(words, 2));
+                    return;
+                } else if (key == "FIELD") {
+                    for (size_t a = 0, arrays = number(words, 2); a < arrays; a++) {
+                        std::vector<std::string> array = line();
+                        size_t components = number(array, 1), tuples = number(array, 2);
+                        if (pointData && components == 3 && tuples == count) {
+                            readVectors(values, count, type(array, 3));
+                            return;
+                        }
+                        skip(components * tuples, type(array, 3));
+                    }
+                } else if (key == "DATASET" || key == "DIMENSIONS" || key == "ORIGIN" || key == "SPACING" || key == "ASPECT_RATIO") {
+                    // values on the same line
+                } else if (key == "POINTS") {
+                    skip(3 * number(words, 1), type(words, 2));
+                } else if (key == "X_COORDINATES" || key == "Y_COORDINATES" || key == "Z_COORDINATES") {
+                    skip(number(words, 1), type(words, 2));
+                } else if (key == "CELLS" || key == "VERTICES" || key == "LINES" || key == "POLYGONS" || key == "TRIANGLE_STRIPS") {
+                    skipConnectivity(number(words, 1), number(words, 2));
+                } else if (key == "CELL_TYPES") {
+                    skip(number(words, 1), "int");
+                } else if (key == "SCALARS") {
+                    size_t components = words.size() > 3 ? number(words, 3) : 1;
+                    std::vector<std::string> table = line();
+                    if (table.empty() || upper(table[0]) != "LOOKUP_TABLE") fail("SCALARS without LOOKUP_TABLE");
+                    skip(components * n, type(words, 2));
+                } else if (key == "LOOKUP_TABLE") {
+                    skip(4 * number(words, 2), binary ? "unsigned_char" : "float");
+                } else if (key == "COLOR_SCALARS") {
+                    skip(number(words, 2) * n, binary ? "unsigned_char" : "float");
+                } else if (key == "VECTORS" || key == "NORMALS") {
+                    skip(3 * n, type(words, 2));
+                } else if (key == "TEXTURE_COORDINATES") {
+                    skip(number(words, 2) * n, type(words, 3));
+                } else if (key == "TENSORS" || key == "TENSORS6") {
+                    skip((key == "TENSORS" ? 9 : 6) * n, type(words, 2));
+                } else if (key == "METADATA") {
+                    // ends with an empty line
+                    while (std::fgets(buffer, sizeof(buffer), file.get()) && std::strspn(buffer, " \t\r\n") < std::strlen(buffer)) {
+                    }
+                } else {
+                    fail("unknown section " + words[0]);
+                }
+            }
+            fail("no point vectors");
+        }
+
+        // the words of the next line that has any
+        std::vector<std::string> line() {
+            std::vector<std::string> words;
+            while (words.empty() && std::fgets(buffer, sizeof(buffer), file.get())) {
+                std::istringstream s(buffer);
+                std::string w;
+                while (s >> w) words.push_back(w);
+            }
+            return words;
+        }
+
+        size_t number(const std::vector<std::string> &words, size_t i) {
+            if (i >= words.size()) fail("incomplete line " + (words.empty() ? std::string() : words[0]));
+            return (size_t) std::stoull(words[i]);
+        }
+
+        std::string type(const std::vector<std::string> &words, size_t i) {
+            if (i >= words.size()) fail("incomplete line " + (words.empty() ? std::string() : words[0]));
+            std::string t = words[i];
+            std::transform(t.begin(), t.end(), t.begin(), [](unsigned char c) { return (char) std::tolower(c); });
+            return t;
+        }
+
+        static std::string upper(std::string s) {
+            std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c) { return (char) std::toupper(c); });
+            return s;
+        }
+
+        size_t size(const std::string &type) {
+            if (type == "bit" || type == "char" || type == "unsigned_char") return 1;
+            if (type == "short" || type == "unsigned_short") return 2;
+            if (type == "int" || type == "unsigned_int" || type == "float") return 4;
+            if (type == "long" || type == "unsigned_long" || type == "double"
+                || type == "vtktypeint64" || type == "vtktypeuint64") return 8;
+            fail("unknown data type " + type);
+            return 0;
+        }
+
+        // the legacy and the 5.1 layout with OFFSETS and CONNECTIVITY arrays
+        void skipConnectivity(size_t first, size_t second) {
+            long at = std::ftell(file.get());
+            std::vector<std::string> words = line();
+            if (!words.empty() && upper(words[0]) == "OFFSETS") {
+                skip(first, type(words, 1));
+                words = line();
+                if (words.empty() || upper(words[0]) != "CONNECTIVITY") fail("OFFSETS without CONNECTIVITY");
+                skip(second, type(words, 1));
+                return;
+            }
+            std::fseek(file.get(), at, SEEK_SET);
+            skip(second, "int");
+        }
+
+        void skip(size_t values, const std::string &type) {
+            if (binary) {
+                if (type == "bit") values = (values + 7) / 8;
+                else values *= size(type);
+                if (std::fseek(file.get(), (long) values, SEEK_CUR) != 0) fail("ends early");
+                return;
+            }
+            for (size_t i = 0; i < values; i++) {
+                if (std::fscanf(file.get(), "%*s") == EOF) fail("ends early");
+            }
+        }
+
+        void readVectors(std::vector<Vector3> &values, size_t count, const std::string &type) {
+            if (binary && type != "float" && type != "double") fail("binary vectors of type " + type + " are not supported");
+            values.resize(count);
+            for (size_t i = 0; i < count; i++) {
+                double v[3];
+                for (size_t c = 0; c < 3; c++) {
+                    v[c] = value(type);
+                }
+                values[i] = Vector3(v[0], v[1], v[2]);
+            }
+        }
+
+        double value(const std::string &type) {
+            if (!binary) {
+                double v;
+                if (std::fscanf(file.get(), "%lf", &v) != 1) fail("ends early or has a broken number");
+                return v;
+            }
+            unsigned char b[8];
+            size_t width = type == "float" ? 4 : 8;
+            if (std::fread(b, 1, width, file.get()) != width) fail("ends early");
+            std::uint64_t bits = 0;
+            for (size_t k = 0; k < width; k++) {
+                bits = (bits << 8) | b[k];
+            }
+            if (width == 8) {
+                double d;
+                std::memcpy(&d, &bits, 8);
+                return d;
+            }
+            std::uint32_t narrow = (std::uint32_t) bits;
+            float f;
+            std::memcpy(&f, &narrow, 4);
+            return f;
+        }
+
+        [[noreturn]] void fail(const std::string &reason) {
+            throw std::runtime_error(path + ": " + reason);
+        }
+
+        std::string path;
+        std::unique_ptr<std::FILE, int (*)(std::FILE *)> file;
+        bool binary = false;
+        char buffer[4096];
+    };
+}
@@ -0,0 +1,324 @@
+#include <fantom/algorithm.hpp>
+#include <fantom/dataset.hpp>
+#include <fantom/register.hpp>
+
+#include "fieldStorage.hpp"
+#include "parallel.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+#include <math.h>
+#include <cmath>
+
+using namespace fantom;
+
+namespace
+{
+
+    class LicTask : public DataAlgorithm
+    {
+
+    public:
+        struct Options : public DataAlgorithm::Options
+        {
+            Options(fantom::Options::Control &control)
+                : DataAlgorithm::Options(control)
+            {
+                add<Field<3, Vector3>>("Field", "3D vector field", definedOn<Grid<3>>(Grid<3>::Points));
+                add<InputChoices>("Slice", "plane of the texture", std::vector<std::string>{"XY", "XZ", "YZ", "Arbitrary"}, "XY");
+                add<double>("Position", "position of an axis aligned slice between the grid bounds, 0 to 1", 0.5);
+                addSeparator();
+                add< double >( "cx", "center of an arbitrary slice in x-dimension", 0.0 );
+                add< double >( "cy", "center of an arbitrary slice in y-dimension", 0.0 );
+                add< double >( "cz", "center of an arbitrary slice in z-dimension", 0.0 );
+                add< double >( "nx", "normal of an arbitrary slice in x-dimension", 0.0 );
+                add< double >( "ny", "normal of an arbitrary slice in y-dimension", 0.0 );
+                add< double >( "nz", "normal of an arbitrary slice in z-dimension", 1.0 );
+                add< double >( "Size", "edge length of an arbitrary slice", 10.0 );
+                addSeparator();
+                add<size_t>("Resolution", "pixels along the longer edge of the texture", 512);
+                add<double>("Kernel length", "half length of the convolution in pixels", 20.0);
+                add<size_t>("Min hits", "streamlines that have to cover a pixel before it is no seed anymore", 2);
+                add<InputChoices>("Storage", "in-memory velocity representation", tasks::FieldStorage::choices(), "Double");
+            }
+        };
+
+        struct DataOutputs : public DataAlgorithm::DataOutputs
+        {
+            DataOutputs(fantom::DataOutputs::Control &control)
+                : DataAlgorithm::DataOutputs(control)
+            {
+                add< const Function< Scalar > >( "LIC" );
+            }
+        };
+
+        LicTask(InitData &data)
+            : DataAlgorithm(data)
+        {
+        }
+
+        // the texture: pixel (i, j) has its center at origin + (i + 0.5) * pixel * u + (j + 0.5) * pixel * v
+        struct Plane
+        {
+            Point3 origin;
+            Vector3 u, v;
+            double pixel;
+            size_t width, height;
+        };
+
+        static const size_t tileSize = 64;
+
+        // white noise that does not depend on the order the tiles are done in
+        static double noise(size_t i) {
+            std::uint64_t h = (i + 1) * 0x9e3779b97f4a7c15ull;
+            h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+            h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+            h ^= h >> 31;
+            return (h >> 11) * (1.0 / 9007199254740992.0);
+        }
+
+        // velocity projected into the plane as a unit vector in pixel coordinates
+        static bool direction(tasks::VelocitySampler &sampler, const Plane &plane, double x, double y, double &dx, double &dy) {
+            Point3 p = plane.origin + (x * plane.pixel) * plane.u + (y * plane.pixel) * plane.v;
+            if (!sampler.reset(p)) return false;
+            Vector3 w = sampler.value();
+            dx = w[0] * plane.u[0] + w[1] * plane.u[1] + w[2] * plane.u[2];
+            dy = w[0] * plane.v[0] + w[1] * plane.v[1] + w[2] * plane.v[2];
+            double length = std::sqrt(dx * dx + dy * dy);
+            if (!(length > 1e-12)) return false;
+            dx /= length;
+            dy /= length;
+            return true;
+        }
+
+        // Runge-Kutta step of length h pixels along the projected field. Unlike
+        // the tracers of the other tasks it steps in the plane with unit speed,
+        // so the samples along a streamline are evenly spaced for the filter.
+        static bool stepRungeKutta(tasks::VelocitySampler &sampler, const Plane &plane, double h, double &x, double &y) {
+            double k[4][2];
+            if (!direction(sampler, plane, x, y, k[0][0], k[0][1])) return false;
+            if (!direction(sampler, plane, x + 0.5 * h * k[0][0], y + 0.5 * h * k[0][1], k[1][0], k[1][1])) return false;
+            if (!direction(sampler, plane, x + 0.5 * h * k[1][0], y + 0.5 * h * k[1][1], k[2][0], k[2][1])) return false;
+            if (!direction(sampler, plane, x + h * k[2][0], y + h * k[2][1], k[3][0], k[3][1])) return false;
+            x += h / 6.0 * (k[0][0] + 2 * k[1][0] + 2 * k[2][0] + k[3][0]);
+            y += h / 6.0 * (k[0][1] + 2 * k[1][1] + 2 * k[2][1] + k[3][1]);
+            return x >= 0 && y >= 0 && x < plane.width && y < plane.height;
+        }
+
+        // fast LIC inside one tile: every streamline is convolved with a moving
+        // box filter, so one trace colours all pixels along it instead of only
+        // its seed. Only pixels of this tile are written, tiles never share data.
+        static void convolveTile(tasks::VelocitySampler &sampler, const Plane &plane,
+                                 size_t i0, size_t j0, size_t i1, size_t j1,
+                                 size_t kernel, size_t minHits,
+                                 std::vector<float> &sum, std::vector<std::uint16_t> &hits) {
+            const double h = 0.5;
+            // window half width and traced length on each side, in samples
+            const size_t half = 2 * kernel;
+            const size_t reach = 2 * half;
+            std::vector<double> xs(2 * reach + 1), ys(2 * reach + 1), ns(2 * reach + 1);
+            auto pixelOf = [&](double x, double y) {
+                return (size_t) x + plane.width * (size_t) y;
+            };
+            for (size_t j = j0; j < j1; j++) {
+                for (size_t i = i0; i < i1; i++) {
+                    if (hits[i + plane.width * j] >= minHits) continue;
+                    // trace both ways from the pixel center, the seed ends up at index c
+                    size_t c = reach;
+                    xs[c] = i + 0.5;
+                    ys[c] = j + 0.5;
+                    size_t first = c, last = c;
+                    bool ended[2] = {false, false};
+                    for (int dir = -1; dir <= 1; dir += 2) {
+                        double x = xs[c], y = ys[c];
+                        for (size_t s = 1; s <= reach; s++) {
+                            if (!stepRungeKutta(sampler, plane, dir * h, x, y)) {
+                                ended[dir > 0] = true;
+                                break;
+                            }
+                            size_t k = dir < 0 ? c - s : c + s;
+                            xs[k] = x;
+                            ys[k] = y;
+                            if (dir < 0) first = k;
+                            else last = k;
+                        }
+                    }
+                    for (size_t k = first; k <= last; k++) {
+                        ns[k] = noise(pixelOf(xs[k], ys[k]));
+                    }
+
+                    // box filter over [k - half, k + half], clipped where the
+                    // field ends. Samples whose window would run past the traced
+                    // part are left to a later streamline. A pixel counts the
+                    // streamline once, not every sample that falls into it.
+                    double box = 0.0;
+                    size_t lo = c, hi = c;
+                    size_t previous = SIZE_MAX;
+                    auto deposit = [&](size_t k) {
+                        double x = xs[k], y = ys[k];
+                        if (x < i0 || x >= i1 || y < j0 || y >= j1) return;
+                        size_t p = pixelOf(x, y);
+                        if (p == previous) return;
+                        previous = p;
+                        sum[p] += (float) (box / (hi - lo + 1));
+                        if (hits[p] < UINT16_MAX) hits[p]++;
+                    };
+                    auto slide = [&](size_t k) {
+                        size_t wantLo = k > first + half ? k - half : first;
+                        size_t wantHi = std::min(last, k + half);
+                        while (hi < wantHi) box += ns[++hi];
+                        while (lo > wantLo) box += ns[--lo];
+                        while (hi > wantHi) box -= ns[hi--];
+                        while (lo < wantLo) box -= ns[lo++];
+                    };
+                    box = ns[c];
+                    slide(c);
+                    double centerBox = box;
+                    size_t centerLo = lo, centerHi = hi;
+                    deposit(c);
+                    for (size_t k = c + 1; k <= last && (k + half <= last || ended[1]); k++) {
+                        slide(k);
+                        deposit(k);
+                    }
+                    box = centerBox;
+                    lo = centerLo;
+                    hi = centerHi;
+                    previous = pixelOf(xs[c], ys[c]);
+                    for (size_t k = c; k > first && (k - 1 >= first + half || ended[0]); k--) {
+                        slide(k - 1);
+                        deposit(k - 1);
+                    }
+                }
+            }
+        }
+
+        virtual void execute(const Algorithm::Options &options, const volatile bool &abortFlag) override
+        {
+            std::shared_ptr<const Field<3, Vector3>> field = options.get<Field<3, Vector3>>("Field");
+            std::shared_ptr<const Function<Vector3>> function = options.get<Function<Vector3>>("Field");
+
+            // if there is no input, do nothing
+            if (!field) {
+                debugLog() << "Input Field not set." << std::endl;
+                return;
+            }
+
+            std::string slice = options.get<std::string>("Slice");
+            size_t resolution = std::max<size_t>(2, options.get<size_t>("Resolution"));
+            Plane plane;
+            if (slice == "Arbitrary") {
+                Vector3 n(options.get<double>("nx"), options.get<double>("ny"), options.get<double>("nz"));
+                double length = norm(n);
+                if (!(length > 0.0)) {
+                    debugLog() << "Slice normal is zero." << std::endl;
+                    return;
+                }
+                n = n / length;
+                // u is perpendicular to n and to the axis n is least aligned with
+                Vector3 a = std::abs(n[0]) < 0.9 ? Vector3(1.0, 0.0, 0.0) : Vector3(0.0, 1.0, 0.0);
+                Vector3 u(a[1] * n[2] - a[2] * n[1], a[2] * n[0] - a[0] * n[2], a[0] * n[1] - a[1] * n[0]);
+                u = u / norm(u);
+                plane.u = u;
+                plane.v = Vector3(n[1] * u[2] - n[2] * u[1], n[2] * u[0] - n[0] * u[2], n[0] * u[1] - n[1] * u[0]);
+                double size = options.get<double>("Size");
+                if (!(size > 0.0)) {
+                    debugLog() << "Slice size must be positive." << std::endl;
+                    return;
+                }
+                Point3 center(options.get<double>("cx"), options.get<double>("cy"), options.get<double>("cz"));
+                plane.origin = center - (0.5 * size) * plane.u - (0.5 * size) * plane.v;
+                plane.pixel = size / resolution;
+                plane.width = resolution;
+                plane.height = resolution;
+            } else {
+                // sanity check that interpolated fields really use the correct grid type. This should never fail
+                std::shared_ptr<const Grid<3>> functionDomainGrid = function
+                    ? std::dynamic_pointer_cast<const Grid<3>>(function->domain()) : nullptr;
+                if (!functionDomainGrid) {
+                    throw std::logic_error("Wrong type of grid!");
+                }
+                const ValueArray<Point3> &points = functionDomainGrid->points();
+                Point3 lo = points[0], hi = points[0];
+                for (size_t i = 1; i < points.size(); i++) {
+                    for (size_t d = 0; d < 3; d++) {
+                        lo[d] = std::min(lo[d], points[i][d]);
+                        hi[d] = std::max(hi[d], points[i][d]);
+                    }
+                }
+                size_t a = slice == "YZ" ? 1 : 0;
+                size_t b = slice == "XY" ? 1 : 2;
+                size_t c = 3 - a - b;
+                Vector3 axes[3] = {Vector3(1.0, 0.0, 0.0), Vector3(0.0, 1.0, 0.0), Vector3(0.0, 0.0, 1.0)};
+                plane.u = axes[a];
+                plane.v = axes[b];
+                plane.origin = lo;
+                plane.origin[c] = lo[c] + options.get<double>("Position") * (hi[c] - lo[c]);
+                plane.pixel = std::max(hi[a] - lo[a], hi[b] - lo[b]) / resolution;
+                if (!(plane.pixel > 0.0)) {
+                    debugLog() << "Grid is flat in the slice." << std::endl;
+                    return;
+                }
+                plane.width = std::max<size_t>(2, (size_t) std::ceil((hi[a] - lo[a]) / plane.pixel));
+                plane.height = std::max<size_t>(2, (size_t) std::ceil((hi[b] - lo[b]) / plane.pixel));
+            }
+
+            tasks::FieldStorage storage(field, function,
+                                        options.get<std::string>("Storage"));
+            debugLog() << storage.describe() << std::endl;
+
+            // tiles go to the threads as they become free, each with its own sampler
+            auto start = std::chrono::steady_clock::now();
+            size_t kernel = std::max<size_t>(1, (size_t) options.get<double>("Kernel length"));
+            size_t minHits = std::max<size_t>(1, options.get<size_t>("Min hits"));
+            size_t nPixels = plane.width * plane.height;
+            std::vector<float> sum(nPixels, 0.0f);
+            std::vector<std::uint16_t> hits(nPixels, 0);
+            std::vector<std::unique_ptr<tasks::VelocitySampler>> samplers(tasks::numThreads());
+            for (auto &sampler : samplers) {
+                sampler = storage.makeSampler();
+            }
+            size_t tilesX = (plane.width + tileSize - 1) / tileSize;
+            size_t tilesY = (plane.height + tileSize - 1) / tileSize;
+            tasks::parallelForDynamic(0, tilesX * tilesY, 1, [&](size_t b, size_t e, size_t t) {
+                for (size_t tile = b; tile < e && !abortFlag; tile++) {
+                    size_t i0 = (tile % tilesX) * tileSize;
+                    size_t j0 = (tile / tilesX) * tileSize;
+                    convolveTile(*samplers[t], plane, i0, j0,
+                                 std::min(plane.width, i0 + tileSize), std::min(plane.height, j0 + tileSize),
+                                 kernel, minHits, sum, hits);
+                }
+            });
+            if (abortFlag) return;
+
+            // pixels outside the field keep their noise, the texture has no holes
+            std::vector<Scalar> values(nPixels);
+            std::vector<Point3> pixels(nPixels);
+            size_t nQuads = (plane.width - 1) * (plane.height - 1);
+            std::vector<size_t> indexes(4 * nQuads);
+            tasks::parallelFor(0, plane.height, [&](size_t b, size_t e, size_t) {
+                for (size_t j = b; j < e; j++) {
+                    for (size_t i = 0; i < plane.width; i++) {
+                        size_t p = i + plane.width * j;
+                        values[p] = Scalar(hits[p] ? sum[p] / hits[p] : noise(p));
+                        pixels[p] = plane.origin + ((i + 0.5) * plane.pixel) * plane.u + ((j + 0.5) * plane.pixel) * plane.v;
+                        if (i + 1 == plane.width || j + 1 == plane.height) continue;
+                        size_t *q = &indexes[4 * (i + (plane.width - 1) * j)];
+                        q[0] = p;
+                        q[1] = p + 1;
+                        q[2] = p + 1 + plane.width;
+                        q[3] = p + plane.width;
+                    }
+                }
+            });
+            debugLog() << "LIC: " << plane.width << "x" << plane.height << " pixels in "
+                       << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count()
+                       << " s on " << tasks::numThreads() << " threads" << std::endl;
+
+            std::pair<Cell::Type, size_t> cellCounts[] = {std::make_pair(Cell::Type::QUAD, nQuads)};
+            std::shared_ptr<const Grid<3>> grid = DomainFactory::makeGrid(pixels, 1, cellCounts, indexes);
+            setResult("LIC", addData(grid, Grid<3>::Points, std::move(values)));
+        }
+    };
+    AlgorithmRegister<LicTask> dummy("Tasks/LIC", "Line integral convolution texture on a slice through an input vector field");
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "parallel.hpp"
+
+#include <fantom/dataset.hpp>
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace tasks
+{
+    using namespace fantom;
+
+    // squared distance of p to the segment from a to b
+    inline double segmentDistance2(const Point3 &p, const Point3 &a, const Point3 &b) {
+        Vector3 ab = b - a;
+        Vector3 ap = p - a;
+        double l2 = ab[0] * ab[0] + ab[1] * ab[1] + ab[2] * ab[2];
+        double t = l2 > 0.0 ? (ap[0] * ab[0] + ap[1] * ab[1] + ap[2] * ab[2]) / l2 : 0.0;
+        t = std::min(1.0, std::max(0.0, t));
+        Vector3 d = ap - t * ab;
+        return d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+    }
+
+    // Douglas-Peucker: keeps the ends and, for every span, the point furthest
+    // from the chord if it is further than tolerance. Spans are worked off a
+    // stack, so long lines do not recurse deeply.
+    inline std::vector<Point3> simplifyLine(const std::vector<Point3> &points, double tolerance) {
+        if (points.size() < 3 || !(tolerance > 0.0)) return points;
+        double t2 = tolerance * tolerance;
+        std::vector<bool> keep(points.size(), false);
+        keep.front() = keep.back() = true;
+        std::vector<std::pair<size_t, size_t>> spans = {{0, points.size() - 1}};
+        while (!spans.empty()) {
+            size_t first = spans.back().first, last = spans.back().second;
+            spans.pop_back();
+            double worst = 0.0;
+            size_t index = first;
+            for (size_t i = first + 1; i < last; i++) {
+                double d2 = segmentDistance2(points[i], points[first], points[last]);
+                if (d2 > worst) {
+                    worst = d2;
+                    index = i;
+                }
+            }
+            if (worst <= t2) continue;
+            keep[index] = true;
+            spans.push_back({first, index});
+            spans.push_back({index, last});
+        }
+        std::vector<Point3> kept;
+        for (size_t i = 0; i < points.size(); i++) {
+            if (keep[i]) kept.push_back(points[i]);
+        }
+        return kept;
+    }
+
+    // simplifies all lines in place in parallel, returns a short summary
+    inline std::string simplifyLines(std::vector<std::vector<Point3>> &lines, double tolerance) {
+        size_t before = 0, after = 0;
+        for (const auto &line : lines) {
+            before += line.size();
+        }
+        parallelForDynamic(0, lines.size(), 16, [&](size_t b, size_t e, size_t) {
+            for (size_t i = b; i < e; i++) {
+                lines[i] = simplifyLine(lines[i], tolerance);
+            }
+        });
+        for (const auto &line : lines) {
+            after += line.size();
+        }
+        std::ostringstream s;
+        s << "line simplification: " << before << " points down to " << after
+          << " at tolerance " << tolerance;
+        return s.str();
+    }
+}
@@ -0,0 +1,305 @@
+#pragma once
+
+#include "parallel.hpp"
+
+#include <fantom/dataset.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace tasks
+{
+    using namespace fantom;
+
+    inline std::vector<std::string> detailChoices() {
+        return {"Full", "50%", "25%", "5%"};
+    }
+
+    // the share of the triangles the levels of detail down to choice keep,
+    // each level is decimated from the one before
+    inline std::vector<double> detailLevels(const std::string &choice) {
+        std::vector<double> levels;
+        for (double ratio : {0.5, 0.25, 0.05}) {
+            if (choice == "Full") break;
+            levels.push_back(ratio);
+            if (choice == std::to_string((int) (ratio * 100)) + "%") break;
+        }
+        return levels;
+    }
+
+    // Symmetric 4x4 error quadric of a set of planes, the sum of the squared
+    // distances of a point to them. Only the ten distinct entries are kept.
+    struct Quadric
+    {
+        double q[10] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+        // the plane n.p + d = 0 with unit normal n, weighted
+        static Quadric plane(const Vector3 &n, double d, double weight) {
+            Quadric Q;
+            double a = n[0], b = n[1], c = n[2];
+            double v[10] = {a * a, a * b, a * c, a * d, b * b, b * c, b * d, c * c, c * d, d * d};
+            for (size_t i = 0; i < 10; i++) {
+                Q.q[i] = weight * v[i];
+            }
+            return Q;
+        }
+
+        Quadric &operator+=(const Quadric &other) {
+            for (size_t i = 0; i < 10; i++) {
+                q[i] += other.q[i];
+            }
+            return *this;
+        }
+
+        double error(const Point3 &p) const {
+            double x = p[0], y = p[1], z = p[2];
+            return q[0] * x * x + 2 * q[1] * x * y + 2 * q[2] * x * z + 2 * q[3] * x
+                 + q[4] * y * y + 2 * q[5] * y * z + 2 * q[6] * y
+                 + q[7] * z * z + 2 * q[8] * z + q[9];
+        }
+
+        // the point of least error, false where the quadric is near singular
+        bool minimum(Point3 &p) const {
+            double a = q[0], b = q[1], c = q[2], e = q[4], f = q[5], i = q[7];
+            double det = a * (e * i - f * f) - b * (b * i - f * c) + c * (b * f - e * c);
+            double scale = std::abs(a) + std::abs(e) + std::abs(i);
+            if (!(std::abs(det) > 1e-12 * scale * scale * scale)) return false;
+            // Cramer's rule on A p = -(q3, q6, q8)
+            double r0 = -q[3], r1 = -q[6], r2 = -q[8];
+            p[0] = (r0 * (e * i - f * f) - b * (r1 * i - f * r2) + c * (r1 * f - e * r2)) / det;
+            p[1] = (a * (r1 * i - f * r2) - r0 * (b * i - f * c) + c * (b * r2 - r1 * c)) / det;
+            p[2] = (a * (e * r2 - r1 * f) - b * (b * r2 - r1 * c) + r0 * (b * f - e * c)) / det;
+            return true;
+        }
+    };
+
+    // Quadric error decimation (Garland and Heckbert) of an indexed triangle
+    // mesh down to about target triangles. The mesh shrinks in rounds: the
+    // vertex quadrics and the costs of all edges are computed in parallel,
+    // the edges sorted, and the cheapest collapses taken as long as they do
+    // not touch the neighbourhood of an earlier one in the same round, so
+    // every collapse of a round sees the quadrics it was ranked by. Border
+    // edges are held in place by planes perpendicular to their triangle, and
+    // collapses that would flip a triangle or pinch the mesh are skipped.
+    // Unused vertices are dropped at the end of every round.
+    inline void decimateMesh(std::vector<PointF<3>> &points, std::vector<unsigned int> &indexes, size_t target) {
+        struct Edge
+        {
+            unsigned int a, b;
+            double cost;
+            Point3 p;
+        };
+        while (indexes.size() / 3 > target) {
+            size_t nV = points.size(), nT = indexes.size() / 3;
+            // triangles around every vertex
+            std::vector<unsigned int> first(nV + 1, 0), around(indexes.size());
+            for (unsigned int v : indexes) {
+                first[v + 1]++;
+            }
+            for (size_t v = 0; v < nV; v++) {
+                first[v + 1] += first[v];
+            }
+            std::vector<unsigned int> fill(first.begin(), first.end() - 1);
+            for (size_t k = 0; k < indexes.size(); k++) {
+                around[fill[indexes[k]]++] = k / 3;
+            }
+            auto point = [&](unsigned int v) {
+                return Point3(points[v][0], points[v][1], points[v][2]);
+            };
+            // twice the area along the normal
+            auto normal = [](const Point3 &a, const Point3 &b, const Point3 &c) {
+                Vector3 u = b - a, w = c - a;
+                return Vector3(u[1] * w[2] - u[2] * w[1], u[2] * w[0] - u[0] * w[2], u[0] * w[1] - u[1] * w[0]);
+            };
+
+            // vertex quadrics, the triangle planes weighted by area plus the border planes
+            std::vector<Quadric> quadric(nV);
+            std::vector<std::vector<Edge>> blockEdges(numThreads());
+            parallelFor(0, nV, [&](size_t b, size_t e, size_t t) {
+                std::vector<std::pair<unsigned int, unsigned int>> neighbours;
+                for (size_t v = b; v < e; v++) {
+                    neighbours.clear();
+                    for (unsigned int k = first[v]; k < first[v + 1]; k++) {
+                        unsigned int f = around[k];
+                        Point3 p0 = point(indexes[3 * f]), p1 = point(indexes[3 * f + 1]), p2 = point(indexes[3 * f + 2]);
+                        for (size_t c = 0; c < 3; c++) {
+                            unsigned int w = indexes[3 * f + c];
+                            if (w != v) neighbours.push_back({w, f});
+                        }
+                        Vector3 n = normal(p0, p1, p2);
+                        double l = norm(n);
+                        if (!(l > 0)) continue;
+                        n = n / l;
+                        quadric[v] += Quadric::plane(n, -(n[0] * p0[0] + n[1] * p0[1] + n[2] * p0[2]), l / 2);
+                    }
+                    std::sort(neighbours.begin(), neighbours.end());
+                    for (size_t i = 0; i < neighbours.size(); i++) {
+                        unsigned int w = neighbours[i].first;
+                        bool border = (i == 0 || neighbours[i - 1].first != w)
+                            && (i + 1 == neighbours.size() || neighbours[i + 1].first != w);
+                        if (border) {
+                            // the plane through the edge perpendicular to its one triangle
+                            unsigned int f = neighbours[i].second;
+                            Point3 p0 = point(indexes[3 * f]), p1 = point(indexes[3 * f + 1]), p2 = point(indexes[3 * f + 2]);
+                            Vector3 n = normal(p0, p1, p2);
+                            Vector3 d = point(w) - point(v);
+                            Vector3 m(d[1] * n[2] - d[2] * n[1], d[2] * n[0] - d[0] * n[2], d[0] * n[1] - d[1] * n[0]);
+                            double l = norm(m);
+                            if (l > 0) {
+                                m = m / l;
+                                Point3 p = point(v);
+                                quadric[v] += Quadric::plane(m, -(m[0] * p[0] + m[1] * p[1] + m[2] * p[2]), 10 * norm(d) * norm(d));
+                            }
+                        }
+                        if (w > v && (i == 0 || neighbours[i - 1].first != w)) {
+                            blockEdges[t].push_back({(unsigned int) v, w, 0, Point3()});
+                        }
+                    }
+                }
+            });
+            std::vector<Edge> edges;
+            for (auto &block : blockEdges) {
+                edges.insert(edges.end(), block.begin(), block.end());
+            }
+
+            // the cost of every collapse and where it puts the vertex, once the quadrics are complete
+            parallelForDynamic(0, edges.size(), 1024, [&](size_t b, size_t e, size_t) {
+                for (size_t i = b; i < e; i++) {
+                    Edge &edge = edges[i];
+                    Quadric Q = quadric[edge.a];
+                    Q += quadric[edge.b];
+                    Point3 pa = point(edge.a), pb = point(edge.b);
+                    Point3 candidates[3] = {pa, pb, pa + 0.5 * (pb - pa)};
+                    edge.p = candidates[2];
+                    edge.cost = Q.error(edge.p);
+                    Point3 p;
+                    if (Q.minimum(p) && norm(p - edge.p) < 2 * norm(pb - pa)) {
+                        edge.p = p;
+                        edge.cost = Q.error(p);
+                    } else {
+                        for (const Point3 &c : candidates) {
+                            if (Q.error(c) < edge.cost) {
+                                edge.cost = Q.error(c);
+                                edge.p = c;
+                            }
+                        }
+                    }
+                }
+            });
+            parallelSort(edges, [](const Edge &x, const Edge &y) {
+                return x.cost < y.cost;
+            });
+
+            // the collapses of this round, none within the triangles of another
+            size_t removed = 0;
+            std::vector<unsigned int> remap(nV);
+            for (size_t v = 0; v < nV; v++) {
+                remap[v] = v;
+            }
+            std::vector<char> locked(nV, 0), gone(nT, 0);
+            std::vector<unsigned int> ringA, ringB;
+            for (const Edge &edge : edges) {
+                if (nT - removed <= target) break;
+                if (locked[edge.a] || locked[edge.b]) continue;
+                // the triangles on the edge go, the others around it must not flip
+                size_t shared = 0;
+                bool flips = false;
+                ringA.clear();
+                ringB.clear();
+                for (unsigned int end : {edge.a, edge.b}) {
+                    for (unsigned int k = first[end]; k < first[end + 1] && !flips; k++) {
+                        unsigned int f = around[k];
+                        unsigned int *c = &indexes[3 * f];
+                        bool hasA = c[0] == edge.a || c[1] == edge.a || c[2] == edge.a;
+                        bool hasB = c[0] == edge.b || c[1] == edge.b || c[2] == edge.b;
+                        if (hasA && hasB) {
+                            if (end == edge.a) shared++;
+                            continue;
+                        }
+                        Point3 before[3], after[3];
+                        for (size_t j = 0; j < 3; j++) {
+                            before[j] = after[j] = point(c[j]);
+                            if (c[j] == end) after[j] = edge.p;
+                            else (end == edge.a ? ringA : ringB).push_back(c[j]);
+                        }
+                        Vector3 n0 = normal(before[0], before[1], before[2]);
+                        Vector3 n1 = normal(after[0], after[1], after[2]);
+                        if (n0[0] * n1[0] + n0[1] * n1[1] + n0[2] * n1[2] <= 0.1 * norm(n0) * norm(n1)) flips = true;
+                    }
+                }
+                if (flips || !shared) continue;
+                // link condition: the two ends share no neighbours but the ones across the edge
+                std::sort(ringA.begin(), ringA.end());
+                ringA.erase(std::unique(ringA.begin(), ringA.end()), ringA.end());
+                std::sort(ringB.begin(), ringB.end());
+                ringB.erase(std::unique(ringB.begin(), ringB.end()), ringB.end());
+                size_t common = 0;
+                for (unsigned int w : ringB) {
+                    if (std::binary_search(ringA.begin(), ringA.end(), w)) common++;
+                }
+                if (common != shared) continue;
+
+                points[edge.a] = PointF<3>(edge.p);
+                remap[edge.b] = edge.a;
+                for (unsigned int end : {edge.a, edge.b}) {
+                    for (unsigned int k = first[end]; k < first[end + 1]; k++) {
+                        unsigned int f = around[k];
+                        for (size_t j = 0; j < 3; j++) {
+                            locked[indexes[3 * f + j]] = 1;
+                        }
+                        const unsigned int *c = &indexes[3 * f];
+                        bool hasA = c[0] == edge.a || c[1] == edge.a || c[2] == edge.a;
+                        bool hasB = c[0] == edge.b || c[1] == edge.b || c[2] == edge.b;
+                        if (hasA && hasB && !gone[f]) {
+                            gone[f] = 1;
+                            removed++;
+                        }
+                    }
+                }
+            }
+            if (!removed) break;
+
+            // the remaining triangles on the surviving vertices, renumbered in order of use
+            std::vector<unsigned int> number(nV, UINT32_MAX);
+            std::vector<PointF<3>> kept;
+            std::vector<unsigned int> remaining;
+            remaining.reserve(indexes.size() - 3 * removed);
+            for (size_t f = 0; f < nT; f++) {
+                if (gone[f]) continue;
+                for (size_t j = 0; j < 3; j++) {
+                    unsigned int v = remap[indexes[3 * f + j]];
+                    if (number[v] == UINT32_MAX) {
+                        number[v] = kept.size();
+                        kept.push_back(points[v]);
+                    }
+                    remaining.push_back(number[v]);
+                }
+            }
+            points.swap(kept);
+            indexes.swap(remaining);
+        }
+    }
+
+    inline double meshArea(const std::vector<PointF<3>> &points, const std::vector<unsigned int> &indexes) {
+        double area = 0.0;
+        for (size_t k = 0; k + 2 < indexes.size(); k += 3) {
+            Vector3 u = Point3(points[indexes[k + 1]]) - Point3(points[indexes[k]]);
+            Vector3 w = Point3(points[indexes[k + 2]]) - Point3(points[indexes[k]]);
+            area += norm(Vector3(u[1] * w[2] - u[2] * w[1], u[2] * w[0] - u[0] * w[2], u[0] * w[1] - u[1] * w[0])) / 2;
+        }
+        return area;
+    }
+
+    // the area shows how far a level strays from the full mesh
+    inline std::string describeDetail(double ratio, size_t triangles, size_t full, double area, double fullArea) {
+        std::ostringstream s;
+        s << "level of detail " << ratio * 100 << "%: " << triangles << " of " << full << " triangles, area "
+          << area << " of " << fullArea;
+        if (fullArea > 0) s << " (" << (area / fullArea - 1) * 100 << "%)";
+        return s.str();
+    }
+}
@@ -0,0 +1,277 @@
+#pragma once
+
+#include <fantom/dataset.hpp>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace tasks
+{
+    using namespace fantom;
+
+    inline std::vector<std::string> exportChoices() {
+        return {"PLY", "VTK"};
+    }
+
+    // Writes through a buffer of its own, so the many small values of a mesh
+    // go out in large blocks. Multi-byte values are written in the byte
+    // order asked for, whatever the machine's.
+    class BufferedFile
+    {
+    public:
+        explicit BufferedFile(std::FILE *file, size_t capacity = 1 << 20)
+            : file(file)
+        {
+            buffer.reserve(capacity);
+        }
+
+        ~BufferedFile() {
+            flush();
+        }
+
+        void write(const void *data, size_t size) {
+            if (buffer.size() + size > buffer.capacity()) flush();
+            if (size > buffer.capacity()) {
+                written += std::fwrite(data, 1, size, file);
+                return;
+            }
+            const char *bytes = static_cast<const char *>(data);
+            buffer.insert(buffer.end(), bytes, bytes + size);
+        }
+
+        void text(const std::string &s) {
+            write(s.data(), s.size());
+        }
+
+        void u8(std::uint8_t v) {
+            write(&v, 1);
+        }
+
+        void u32(std::uint32_t v, bool bigEndian) {
+            unsigned char b[4];
+            for (size_t i = 0; i < 4; i++) {
+                b[bigEndian ? 3 - i : i] = (unsigned char) (v >> (8 * i));
+            }
+            write(b, 4);
+        }
+
+        void f32(float v, bool bigEndian) {
+            std::uint32_t bits;
+            std::memcpy(&bits, &v, 4);
+            u32(bits, bigEndian);
+        }
+
+        void flush() {
+            if (buffer.empty()) return;
+            written += std::fwrite(buffer.data(), 1, buffer.size(), file);
+            buffer.clear();
+        }
+
+        // bytes written so far, the buffered ones included
+        size_t bytes() const {
+            return written + buffer.size();
+        }
+
+    private:
+        std::FILE *file;
+        std::vector<char> buffer;
+        size_t written = 0;
+    };
+
+    // Streams triangles and polylines into a binary PLY (little endian) or
+    // legacy VTK PolyData file while they are generated, so they need not
+    // be kept. The vertices go to the file right away, the triangles and
+    // lines to temporary files that are appended on close, and the counts
+    // in the header are filled in then. PLY stores the polylines as edges.
+    class MeshWriter
+    {
+    public:
+        MeshWriter(const std::string &path, const std::string &format)
+            : vtk(format == "VTK"), file(std::fopen(path.c_str(), "wb"), &std::fclose),
+              faceFile(std::tmpfile(), &std::fclose), lineFile(std::tmpfile(), &std::fclose), path(path)
+        {
+            if (!file || !faceFile || !lineFile) {
+                // whatever did open is closed again, and no empty file is left behind
+                faceFile.reset();
+                lineFile.reset();
+                if (file) {
+                    file.reset();
+                    std::remove(path.c_str());
+                }
+                return;
+            }
+            opened = true;
+            out.reset(new BufferedFile(file.get()));
+            faces.reset(new BufferedFile(faceFile.get()));
+            lines.reset(new BufferedFile(lineFile.get()));
+            if (vtk) {
+                out->text("# vtk DataFile Version 3.0\n" + path + "\nBINARY\nDATASET POLYDATA\nPOINTS ");
+                vertexCountAt = out->bytes();
+                out->text(padded(0) + " float\n");
+            } else {
+                out->text("ply\nformat binary_little_endian 1.0\nelement vertex ");
+                vertexCountAt = out->bytes();
+                out->text(padded(0) + "\nproperty float x\nproperty float y\nproperty float z\nelement face ");
+                faceCountAt = out->bytes();
+                out->text(padded(0) + "\nproperty list uchar int vertex_indices\nelement edge ");
+                edgeCountAt = out->bytes();
+                out->text(padded(0) + "\nproperty int vertex1\nproperty int vertex2\nend_header\n");
+            }
+        }
+
+        ~MeshWriter() {
+            close();
+        }
+
+        bool good() const {
+            return opened;
+        }
+
+        // held by whoever writes from several threads
+        std::mutex &mutex() {
+            return guard;
+        }
+
+        std::uint32_t addVertex(const Point<3> &p) {
+            for (size_t d = 0; d < 3; d++) {
+                out->f32((float) p[d], vtk);
+            }
+            return vertices++;
+        }
+
+        void addTriangle(std::uint32_t a, std::uint32_t b, std::uint32_t c) {
+            if (vtk) faces->u32(3, true);
+            else faces->u8(3);
+            for (std::uint32_t v : {a, b, c}) {
+                faces->u32(v, vtk);
+            }
+            triangles++;
+        }
+
+        // a triangle of its own three vertices
+        void addTriangle(const Point<3> &a, const Point<3> &b, const Point<3> &c) {
+            std::uint32_t first = addVertex(a);
+            addVertex(b);
+            addVertex(c);
+            addTriangle(first, first + 1, first + 2);
+        }
+
+        // the polyline through n vertices starting at ids
+        void addLine(const std::uint32_t *ids, size_t n) {
+            if (n < 2) return;
+            if (vtk) {
+                lines->u32((std::uint32_t) n, true);
+                for (size_t i = 0; i < n; i++) {
+                    lines->u32(ids[i], true);
+                }
+                lineCells++;
+                lineSize += n + 1;
+            } else {
+                for (size_t i = 0; i + 1 < n; i++) {
+                    lines->u32(ids[i], false);
+                    lines->u32(ids[i + 1], false);
+                }
+                lineCells += n - 1;
+            }
+            segments += n - 1;
+        }
+
+        // a polyline of its own vertices
+        void addLine(const std::vector<Point<3>> &points) {
+            if (points.size() < 2) return;
+            std::vector<std::uint32_t> ids;
+            ids.reserve(points.size());
+            for (const Point<3> &p : points) {
+                ids.push_back(addVertex(p));
+            }
+            addLine(ids.data(), ids.size());
+        }
+
+        // Appends the triangles and lines and fills in the counts, false if
+        // the file could not be written completely. Called by the destructor
+        // too, only the first call does anything.
+        bool close() {
+            if (!good() || closed) return ok;
+            closed = true;
+            faces->flush();
+            lines->flush();
+            if (vtk) {
+                if (lineCells) {
+                    out->text("\nLINES " + std::to_string(lineCells) + " " + std::to_string(lineSize) + "\n");
+                    append(lineFile.get());
+                }
+                if (triangles) {
+                    out->text("\nPOLYGONS " + std::to_string(triangles) + " " + std::to_string(4 * triangles) + "\n");
+                    append(faceFile.get());
+                }
+            } else {
+                append(faceFile.get());
+                append(lineFile.get());
+            }
+            out->flush();
+            bytes = out->bytes();
+            patch(vertexCountAt, vertices);
+            if (!vtk) {
+                patch(faceCountAt, triangles);
+                patch(edgeCountAt, lineCells);
+            }
+            ok = ok && !std::ferror(file.get());
+            out.reset();
+            faces.reset();
+            lines.reset();
+            ok = std::fclose(file.release()) == 0 && ok;
+            faceFile.reset();
+            lineFile.reset();
+            return ok;
+        }
+
+        std::string describe() const {
+            std::ostringstream s;
+            s << "export: " << vertices << " vertices, " << triangles << " triangles and "
+              << segments << " line segments to " << path;
+            if (closed) s << ", " << bytes / 1048576.0 << " MB";
+            if (!good() || !ok) s << " failed";
+            return s.str();
+        }
+
+    private:
+        // counts are written with a fixed width, so they can be filled in later
+        static std::string padded(size_t n) {
+            char text[16];
+            std::snprintf(text, sizeof(text), "%010zu", n);
+            return text;
+        }
+
+        void append(std::FILE *from) {
+            std::rewind(from);
+            std::vector<char> block(1 << 20);
+            size_t n;
+            while ((n = std::fread(block.data(), 1, block.size(), from)) > 0) {
+                out->write(block.data(), n);
+            }
+            ok = ok && !std::ferror(from);
+        }
+
+        void patch(size_t at, size_t count) {
+            std::string text = padded(count);
+            ok = ok && std::fseek(file.get(), (long) at, SEEK_SET) == 0
+                && std::fwrite(text.data(), 1, text.size(), file.get()) == text.size();
+        }
+
+        bool vtk;
+        std::unique_ptr<std::FILE, int (*)(std::FILE *)> file, faceFile, lineFile;
+        std::string path;
+        std::unique_ptr<BufferedFile> out, faces, lines;
+        size_t vertexCountAt = 0, faceCountAt = 0, edgeCountAt = 0;
+        std::uint32_t vertices = 0;
+        size_t triangles = 0, lineCells = 0, lineSize = 0, segments = 0, bytes = 0;
+        bool opened = false, closed = false, ok = true;
+        std::mutex guard;
+    };
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace tasks
+{
+    inline size_t numThreads() {
+        return std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    // splits [begin, end) into one contiguous block per thread and calls
+    // body(blockBegin, blockEnd, threadIndex) for each of them
+    template <typename Body>
+    void parallelFor(size_t begin, size_t end, Body body) {
+        size_t n = end > begin ? end - begin : 0;
+        size_t nThreads = std::min(numThreads(), n);
+        if (nThreads <= 1) {
+            if (n) body(begin, end, size_t(0));
+            return;
+        }
+        std::vector<std::thread> threads;
+        size_t block = (n + nThreads - 1) / nThreads;
+        for (size_t t = 0; t < nThreads; t++) {
+            size_t b = begin + t * block;
+            size_t e = std::min(end, b + block);
+            if (b >= e) break;
+            threads.emplace_back(body, b, e, t);
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+    }
+
+    // like parallelFor, but the threads fetch chunks of grain iterations from a
+    // shared counter whenever they are done, so loops with very uneven
+    // iterations stay balanced
+    template <typename Body>
+    void parallelForDynamic(size_t begin, size_t end, size_t grain, Body body) {
+        size_t n = end > begin ? end - begin : 0;
+        grain = std::max<size_t>(1, grain);
+        size_t nThreads = std::min(numThreads(), (n + grain - 1) / grain);
+        std::atomic<size_t> next(begin);
+        auto work = [&](size_t t) {
+            for (;;) {
+                size_t b = next.fetch_add(grain);
+                if (b >= end) break;
+                body(b, std::min(end, b + grain), t);
+            }
+        };
+        if (nThreads <= 1) {
+            if (n) work(0);
+            return;
+        }
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < nThreads; t++) {
+            threads.emplace_back(work, t);
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+    }
+
+    // std::sort on every block in parallel, then the sorted blocks are merged
+    template <typename T, typename Less>
+    void parallelSort(std::vector<T> &values, Less less) {
+        size_t nThreads = std::min(numThreads(), std::max<size_t>(1, values.size() / 4096));
+        size_t block = (values.size() + nThreads - 1) / std::max<size_t>(1, nThreads);
+        parallelFor(0, nThreads, [&](size_t b, size_t e, size_t) {
+            for (size_t t = b; t < e; t++) {
+                auto first = values.begin() + std::min(values.size(), t * block);
+                auto last = values.begin() + std::min(values.size(), (t + 1) * block);
+                std::sort(first, last, less);
+            }
+        });
+        for (size_t width = block; width < values.size(); width *= 2) {
+            for (size_t b = 0; b + width < values.size(); b += 2 * width) {
+                std::inplace_merge(values.begin() + b,
+                                   values.begin() + b + width,
+                                   values.begin() + std::min(values.size(), b + 2 * width),
+                                   less);
+            }
+        }
+    }
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace tasks
+{
+    // one ribbon of a stream surface front, the strip between two
+    // neighbouring streamlines
+    struct Ribbon
+    {
+        std::uint32_t posL, posR;   // step reached on the left and right streamline
+        std::uint32_t lineL, lineR; // the streamlines
+        std::uint32_t maxStep;      // steps the ribbon may take
+        std::uint32_t alive;        // 0 once the ribbon tore
+        std::uint32_t prev = 0;     // neighbours in the front, set by RibbonFront
+        std::uint32_t next = 0;
+    };
+
+    // The ribbons of a front from left to right as a doubly linked list in one
+    // pool. Handles stay valid until their ribbon is erased, so inserting or
+    // removing a particle is constant time and does not move the others.
+    // References into the front are invalidated by insertions.
+    class RibbonFront
+    {
+    public:
+        typedef std::uint32_t Handle;
+        enum : Handle { None = UINT32_MAX };
+
+        Handle first() const {
+            return head;
+        }
+
+        Handle last() const {
+            return tail;
+        }
+
+        Handle next(Handle h) const {
+            return pool[h].next;
+        }
+
+        Handle prev(Handle h) const {
+            return pool[h].prev;
+        }
+
+        size_t size() const {
+            return count;
+        }
+
+        Ribbon &operator[](Handle h) {
+            return pool[h];
+        }
+
+        const Ribbon &operator[](Handle h) const {
+            return pool[h];
+        }
+
+        Handle pushBack(const Ribbon &ribbon) {
+            return insertAfter(tail, ribbon);
+        }
+
+        // after = None inserts at the front
+        Handle insertAfter(Handle after, const Ribbon &ribbon) {
+            Handle h;
+            if (!unused.empty()) {
+                h = unused.back();
+                unused.pop_back();
+                pool[h] = ribbon;
+            } else {
+                h = (Handle) pool.size();
+                pool.push_back(ribbon);
+            }
+            Handle before = after == None ? head : pool[after].next;
+            pool[h].prev = after;
+            pool[h].next = before;
+            if (after == None) head = h;
+            else pool[after].next = h;
+            if (before == None) tail = h;
+            else pool[before].prev = h;
+            count++;
+            return h;
+        }
+
+        void erase(Handle h) {
+            Handle before = pool[h].prev, after = pool[h].next;
+            if (before == None) head = after;
+            else pool[before].next = after;
+            if (after == None) tail = before;
+            else pool[after].prev = before;
+            unused.push_back(h);
+            count--;
+        }
+
+    private:
+        std::vector<Ribbon> pool;
+        std::vector<Handle> unused;
+        Handle head = None, tail = None;
+        size_t count = 0;
+    };
+}
@@ -0,0 +1,225 @@
+#pragma once
+
+#include "seedGenerators.hpp"
+
+#include <fantom/dataset.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace tasks
+{
+    using namespace fantom;
+
+    inline std::vector<std::string> curveChoices() {
+        return {"Segment", "Polyline", "Circle", "Spline", "Grid lines"};
+    }
+
+    // A seed curve as a polyline parametrised by arc length. A closed curve
+    // joins its last vertex back to the first, which is not repeated.
+    class SeedCurve
+    {
+    public:
+        SeedCurve(std::vector<Point3> vertices, bool closed = false)
+            : vertices(std::move(vertices)), isClosed(closed && this->vertices.size() > 2)
+        {
+            arc.push_back(0.0);
+            size_t n = this->vertices.size();
+            size_t segments = isClosed ? n : (n > 0 ? n - 1 : 0);
+            for (size_t k = 0; k < segments; k++) {
+                arc.push_back(arc.back() + norm(vertex(k + 1) - vertex(k)));
+            }
+        }
+
+        double length() const {
+            return arc.back();
+        }
+
+        bool closed() const {
+            return isClosed;
+        }
+
+        bool empty() const {
+            return vertices.empty();
+        }
+
+        // the point at the fraction u of the arc length, u in [0, 1]
+        Point3 at(double u) const {
+            if (arc.size() < 2) return vertices.empty() ? Point3() : vertices[0];
+            double s = std::min(1.0, std::max(0.0, u)) * length();
+            size_t k = std::upper_bound(arc.begin(), arc.end(), s) - arc.begin();
+            k = std::min(std::max<size_t>(k, 1), arc.size() - 1) - 1;
+            double l = arc[k + 1] - arc[k];
+            double t = l > 0.0 ? (s - arc[k]) / l : 0.0;
+            return vertex(k) + t * (vertex(k + 1) - vertex(k));
+        }
+
+        // Fractions of the arc length for seeds no more than spacing apart,
+        // both ends of an open curve included and at least three on a closed
+        // one. at(u) of them, or of a quantile of them, gives the seeds.
+        std::vector<double> fractions(double spacing) const {
+            size_t n = spacing > 0.0 ? (size_t) (length() / spacing + 1) : 1;
+            std::vector<double> u;
+            if (isClosed) {
+                n = std::max<size_t>(n, 3);
+                for (size_t i = 0; i < n; i++) {
+                    u.push_back(double(i) / n);
+                }
+            } else {
+                for (size_t i = 0; i <= n; i++) {
+                    u.push_back(double(i) / n);
+                }
+            }
+            return u;
+        }
+
+        void outline(std::vector<Point3> &segments) const {
+            for (size_t k = 0; k + 1 < arc.size(); k++) {
+                segments.push_back(vertex(k));
+                segments.push_back(vertex(k + 1));
+            }
+        }
+
+    private:
+        const Point3 &vertex(size_t k) const {
+            return vertices[k % vertices.size()];
+        }
+
+        std::vector<Point3> vertices;
+        std::vector<double> arc;
+        bool isClosed;
+    };
+
+    // the circle around centre through rim, in the plane perpendicular to
+    // normal, as a closed polygon of n vertices
+    inline SeedCurve circleCurve(const Point3 &centre, const Point3 &rim, Vector3 normal, size_t n = 128) {
+        double l = norm(normal);
+        normal = l > 0.0 ? normal / l : Vector3(0.0, 0.0, 1.0);
+        Vector3 r = rim - centre;
+        Vector3 a = r - (r[0] * normal[0] + r[1] * normal[1] + r[2] * normal[2]) * normal;
+        if (!(norm(a) > 0.0)) return SeedCurve({centre});
+        Vector3 b(normal[1] * a[2] - normal[2] * a[1],
+                  normal[2] * a[0] - normal[0] * a[2],
+                  normal[0] * a[1] - normal[1] * a[0]);
+        std::vector<Point3> vertices;
+        for (size_t i = 0; i < n; i++) {
+            double phi = 2.0 * M_PI * i / n;
+            vertices.push_back(centre + std::cos(phi) * a + std::sin(phi) * b);
+        }
+        return SeedCurve(vertices, true);
+    }
+
+    // Catmull-Rom spline through the points, perSpan vertices per span
+    inline SeedCurve splineCurve(const std::vector<Point3> &points, bool closed, size_t perSpan = 16) {
+        size_t n = points.size();
+        if (n < 3) return SeedCurve(points);
+        auto point = [&](long k) {
+            if (closed) return points[(k % (long) n + n) % n];
+            return points[std::min<long>(std::max<long>(k, 0), n - 1)];
+        };
+        std::vector<Point3> vertices;
+        size_t spans = closed ? n : n - 1;
+        for (size_t k = 0; k < spans; k++) {
+            Point3 p0 = point(k - 1), p1 = point(k), p2 = point(k + 1), p3 = point(k + 2);
+            for (size_t i = 0; i < perSpan; i++) {
+                double t = double(i) / perSpan, t2 = t * t, t3 = t2 * t;
+                vertices.push_back(0.5 * ((2.0 * p1) + (-1.0 * p0 + p2) * t
+                                          + (2.0 * p0 - 5.0 * p1 + 4.0 * p2 - 1.0 * p3) * t2
+                                          + (-1.0 * p0 + 3.0 * p1 - 3.0 * p2 + p3) * t3));
+            }
+        }
+        if (!closed) vertices.push_back(points.back());
+        return SeedCurve(vertices, closed);
+    }
+
+    // The chains of line cells of a grid. Cells that share a point are
+    // joined, chains end at points with other than two line cells, and a
+    // chain that comes back to its start is closed.
+    inline std::vector<SeedCurve> gridCurves(const Grid<3> &grid) {
+        const ValueArray<Point3> &points = grid.points();
+        std::vector<std::pair<size_t, size_t>> edges;
+        std::map<size_t, std::vector<size_t>> incident;
+        for (size_t c = 0; c < grid.numCells(); c++) {
+            Cell cell = grid.cell(c);
+            if (cell.type() != Cell::Type::LINE) continue;
+            size_t a = cell.index(0), b = cell.index(1);
+            incident[a].push_back(edges.size());
+            incident[b].push_back(edges.size());
+            edges.push_back({a, b});
+        }
+        std::vector<bool> used(edges.size(), false);
+        std::vector<SeedCurve> curves;
+        auto walk = [&](size_t p, size_t e) {
+            size_t start = p;
+            std::vector<Point3> vertices = {points[p]};
+            while (true) {
+                used[e] = true;
+                p = edges[e].first == p ? edges[e].second : edges[e].first;
+                if (p == start) {
+                    curves.push_back(SeedCurve(vertices, true));
+                    return;
+                }
+                vertices.push_back(points[p]);
+                const std::vector<size_t> &next = incident[p];
+                if (next.size() != 2) break;
+                e = used[next[0]] ? next[1] : next[0];
+                if (used[e]) break;
+            }
+            curves.push_back(SeedCurve(vertices));
+        };
+        // open chains from their ends and branch points, what is left are loops
+        for (auto &point : incident) {
+            if (point.second.size() == 2) continue;
+            for (size_t e : point.second) {
+                if (!used[e]) walk(point.first, e);
+            }
+        }
+        for (size_t e = 0; e < edges.size(); e++) {
+            if (!used[e]) walk(edges[e].first, e);
+        }
+        return curves;
+    }
+
+    // The curve chosen in the options: the segment from start to end, a
+    // polyline or spline through the listed points, or the circle around
+    // start through end perpendicular to normal. Grid lines come from
+    // gridCurves instead.
+    inline SeedCurve makeSeedCurve(const std::string &kind, const Point3 &start, const Point3 &end,
+                                   const std::string &points, bool closed, const std::string &normal) {
+        if (kind == "Polyline") {
+            return SeedCurve(parsePoints(points), closed);
+        } else if (kind == "Spline") {
+            return splineCurve(parsePoints(points), closed);
+        } else if (kind == "Circle") {
+            std::vector<Point3> n = parsePoints(normal);
+            return circleCurve(start, end, n.empty() ? Vector3(0.0, 0.0, 1.0) : n[0]);
+        }
+        return SeedCurve({start, end});
+    }
+
+    // Several curves of one kind typed into an option, separated by
+    // semicolons: "x y z, x y z; x y z, ...". Every entry is a polyline, a
+    // spline through its points, or for a circle its centre and a rim point.
+    inline std::vector<SeedCurve> parseSeedCurves(const std::string &kind, const std::string &text,
+                                                  bool closed, const std::string &normal) {
+        std::vector<SeedCurve> curves;
+        std::stringstream list(text);
+        std::string entry;
+        while (std::getline(list, entry, ';')) {
+            std::vector<Point3> points = parsePoints(entry);
+            if (points.size() < 2) continue;
+            if (kind == "Circle") {
+                curves.push_back(makeSeedCurve(kind, points[0], points[1], "", false, normal));
+            } else if (kind == "Spline") {
+                curves.push_back(splineCurve(points, closed));
+            } else {
+                curves.push_back(SeedCurve(points, closed));
+            }
+        }
+        return curves;
+    }
+}
@@ -0,0 +1,354 @@
+#pragma once
+
+#include "spatialHash.hpp"
+
+#include <fantom/dataset.hpp>
+
+#include <cmath>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace tasks
+{
+    using namespace fantom;
+
+    // Seeds are produced one at a time, nothing is stored up front, so a million
+    // seeds cost no more memory than one. outline() gives line segments (pairs
+    // of points) that show where the seeds come from.
+    class SeedGenerator
+    {
+    public:
+        virtual ~SeedGenerator() = default;
+
+        // the next seed, false once all are handed out
+        virtual bool next(Point3 &p) = 0;
+        virtual void outline(std::vector<Point3> &segments) const = 0;
+    };
+
+    // lets a generator be used in a range based for loop
+    class SeedRange
+    {
+    public:
+        class iterator
+        {
+        public:
+            iterator(SeedGenerator *generator)
+                : generator(generator)
+            {
+                ++*this;
+            }
+
+            const Point3 &operator*() const {
+                return p;
+            }
+
+            iterator &operator++() {
+                if (generator && !generator->next(p)) generator = nullptr;
+                return *this;
+            }
+
+            bool operator!=(const iterator &o) const {
+                return generator != o.generator;
+            }
+
+        private:
+            SeedGenerator *generator;
+            Point3 p;
+        };
+
+        SeedRange(SeedGenerator &generator)
+            : generator(generator)
+        {
+        }
+
+        iterator begin() {
+            return iterator(&generator);
+        }
+
+        iterator end() {
+            return iterator(nullptr);
+        }
+
+    private:
+        SeedGenerator &generator;
+    };
+
+    inline SeedRange seeds(SeedGenerator &generator) {
+        return SeedRange(generator);
+    }
+
+    // the twelve edges of the box [lo, hi]
+    inline void boxOutline(const Point3 &lo, const Point3 &hi, std::vector<Point3> &segments) {
+        for (size_t a = 0; a < 3; a++) {
+            size_t b = (a + 1) % 3, c = (a + 2) % 3;
+            for (size_t k = 0; k < 4; k++) {
+                Point3 p = lo;
+                p[b] = k & 1 ? hi[b] : lo[b];
+                p[c] = k & 2 ? hi[c] : lo[c];
+                Point3 q = p;
+                q[a] = hi[a];
+                segments.push_back(p);
+                segments.push_back(q);
+            }
+        }
+    }
+
+    // the points of a uniform grid, x running fastest like DomainFactory::makeUniformGrid.
+    // With jitter every point is moved randomly by up to half a spacing.
+    class LatticeSeeds : public SeedGenerator
+    {
+    public:
+        LatticeSeeds(const double origin[3], const size_t extent[3], const double spacing[3],
+                     bool jitter = false, unsigned int seed = 0)
+            : jitter(jitter), rng(seed), offset(-0.5, 0.5), i(0)
+        {
+            for (size_t d = 0; d < 3; d++) {
+                this->origin[d] = origin[d];
+                this->extent[d] = extent[d];
+                this->spacing[d] = spacing[d];
+            }
+        }
+
+        bool next(Point3 &p) override {
+            if (i >= extent[0] * extent[1] * extent[2]) return false;
+            size_t ijk[3] = {i % extent[0], i / extent[0] % extent[1], i / (extent[0] * extent[1])};
+            for (size_t d = 0; d < 3; d++) {
+                p[d] = origin[d] + (ijk[d] + (jitter ? offset(rng) : 0.0)) * spacing[d];
+            }
+            i++;
+            return true;
+        }
+
+        void outline(std::vector<Point3> &segments) const override {
+            Point3 lo, hi;
+            for (size_t d = 0; d < 3; d++) {
+                lo[d] = origin[d];
+                hi[d] = origin[d] + (extent[d] > 0 ? extent[d] - 1 : 0) * spacing[d];
+            }
+            boxOutline(lo, hi, segments);
+        }
+
+    private:
+        double origin[3];
+        size_t extent[3];
+        double spacing[3];
+        bool jitter;
+        std::mt19937 rng;
+        std::uniform_real_distribution<double> offset;
+        size_t i;
+    };
+
+    // count uniformly distributed random points in the box [lo, hi]
+    class RandomSeeds : public SeedGenerator
+    {
+    public:
+        RandomSeeds(const Point3 &lo, const Point3 &hi, size_t count, unsigned int seed = 0)
+            : lo(lo), hi(hi), count(count), rng(seed), unit(0.0, 1.0)
+        {
+        }
+
+        bool next(Point3 &p) override {
+            if (!count) return false;
+            for (size_t d = 0; d < 3; d++) {
+                p[d] = lo[d] + unit(rng) * (hi[d] - lo[d]);
+            }
+            count--;
+            return true;
+        }
+
+        void outline(std::vector<Point3> &segments) const override {
+            boxOutline(lo, hi, segments);
+        }
+
+    private:
+        Point3 lo, hi;
+        size_t count;
+        std::mt19937 rng;
+        std::uniform_real_distribution<double> unit;
+    };
+
+    // random points in the box that keep at least radius to each other (dart
+    // throwing). Ends after count points or when no free spot was hit in
+    // maxAttempts throws in a row.
+    class PoissonDiskSeeds : public SeedGenerator
+    {
+    public:
+        PoissonDiskSeeds(const Point3 &lo, const Point3 &hi, double radius, size_t count,
+                         unsigned int seed = 0, size_t maxAttempts = 1000)
+            : lo(lo), hi(hi), radius(radius), count(count), maxAttempts(maxAttempts),
+              rng(seed), unit(0.0, 1.0), taken(radius > 0.0 ? radius : 1.0)
+        {
+        }
+
+        bool next(Point3 &p) override {
+            if (!count) return false;
+            for (size_t attempt = 0; attempt < maxAttempts; attempt++) {
+                for (size_t d = 0; d < 3; d++) {
+                    p[d] = lo[d] + unit(rng) * (hi[d] - lo[d]);
+                }
+                if (taken.near(p, radius)) continue;
+                taken.insert(p, 0);
+                count--;
+                return true;
+            }
+            count = 0;
+            return false;
+        }
+
+        void outline(std::vector<Point3> &segments) const override {
+            boxOutline(lo, hi, segments);
+        }
+
+    private:
+        Point3 lo, hi;
+        double radius;
+        size_t count;
+        size_t maxAttempts;
+        std::mt19937 rng;
+        std::uniform_real_distribution<double> unit;
+        SpatialHash taken;
+    };
+
+    // count points spread evenly by arc length along a polyline, including both ends
+    class PolylineSeeds : public SeedGenerator
+    {
+    public:
+        PolylineSeeds(std::vector<Point3> vertices, size_t count)
+            : vertices(std::move(vertices)), count(count), i(0), segment(0)
+        {
+            length.push_back(0.0);
+            for (size_t k = 1; k < this->vertices.size(); k++) {
+                length.push_back(length.back() + norm(this->vertices[k] - this->vertices[k - 1]));
+            }
+        }
+
+        bool next(Point3 &p) override {
+            if (i >= count || vertices.empty()) return false;
+            double s = count > 1 ? length.back() * i / (count - 1) : 0.0;
+            while (segment + 2 < length.size() && length[segment + 1] < s) segment++;
+            if (vertices.size() == 1) {
+                p = vertices[0];
+            } else {
+                double l = length[segment + 1] - length[segment];
+                double t = l > 0.0 ? (s - length[segment]) / l : 0.0;
+                p = vertices[segment] + std::min(1.0, t) * (vertices[segment + 1] - vertices[segment]);
+            }
+            i++;
+            return true;
+        }
+
+        void outline(std::vector<Point3> &segments) const override {
+            for (size_t k = 1; k < vertices.size(); k++) {
+                segments.push_back(vertices[k - 1]);
+                segments.push_back(vertices[k]);
+            }
+        }
+
+    private:
+        std::vector<Point3> vertices;
+        std::vector<double> length;
+        size_t count;
+        size_t i;
+        size_t segment;
+    };
+
+    // nu * nv points on the plane origin + i * du * u + j * dv * v
+    class PlaneSeeds : public SeedGenerator
+    {
+    public:
+        PlaneSeeds(const Point3 &origin, const Vector3 &u, const Vector3 &v, size_t nu, size_t nv)
+            : origin(origin), u(u), v(v), nu(nu), nv(nv), i(0)
+        {
+        }
+
+        // the plane through origin with the given normal, the spacings along
+        // two axes perpendicular to it
+        static std::unique_ptr<PlaneSeeds> fromNormal(const Point3 &origin, Vector3 normal,
+                                                      size_t nu, size_t nv, double du, double dv) {
+            double l = norm(normal);
+            normal = l > 0.0 ? normal / l : Vector3(0.0, 0.0, 1.0);
+            Vector3 axis = std::abs(normal[0]) < 0.9 ? Vector3(1.0, 0.0, 0.0) : Vector3(0.0, 1.0, 0.0);
+            Vector3 a(normal[1] * axis[2] - normal[2] * axis[1],
+                      normal[2] * axis[0] - normal[0] * axis[2],
+                      normal[0] * axis[1] - normal[1] * axis[0]);
+            a = a / norm(a);
+            Vector3 b(normal[1] * a[2] - normal[2] * a[1],
+                      normal[2] * a[0] - normal[0] * a[2],
+                      normal[0] * a[1] - normal[1] * a[0]);
+            return std::unique_ptr<PlaneSeeds>(new PlaneSeeds(origin, du * a, dv * b, nu, nv));
+        }
+
+        bool next(Point3 &p) override {
+            if (i >= nu * nv) return false;
+            p = origin + (double) (i % nu) * u + (double) (i / nu) * v;
+            i++;
+            return true;
+        }
+
+        void outline(std::vector<Point3> &segments) const override {
+            double a = nu > 0 ? nu - 1.0 : 0.0, b = nv > 0 ? nv - 1.0 : 0.0;
+            Point3 corners[4] = {origin, origin + a * u, origin + a * u + b * v, origin + b * v};
+            for (size_t k = 0; k < 4; k++) {
+                segments.push_back(corners[k]);
+                segments.push_back(corners[(k + 1) % 4]);
+            }
+        }
+
+    private:
+        Point3 origin;
+        Vector3 u, v;
+        size_t nu, nv;
+        size_t i;
+    };
+
+    // "x y z, x y z, ..." as typed into an option
+    inline std::vector<Point3> parsePoints(const std::string &text) {
+        std::vector<Point3> points;
+        std::stringstream list(text);
+        std::string item;
+        while (std::getline(list, item, ',')) {
+            std::istringstream s(item);
+            Point3 p;
+            if (s >> p[0] >> p[1] >> p[2]) points.push_back(p);
+        }
+        return points;
+    }
+
+    inline std::vector<std::string> seedChoices() {
+        return {"Uniform", "Jittered", "Random", "Poisson disk", "Polyline", "Plane"};
+    }
+
+    // the generator chosen in the options. The box of the uniform grid
+    // (origin, extent, spacing) also bounds the random kinds, which produce
+    // as many seeds as the grid has points.
+    inline std::unique_ptr<SeedGenerator> makeSeedGenerator(const std::string &kind,
+                                                            const double origin[3], const size_t extent[3], const double spacing[3],
+                                                            unsigned int seed,
+                                                            const std::string &polyline,
+                                                            const std::string &normal) {
+        size_t count = extent[0] * extent[1] * extent[2];
+        Point3 lo(origin[0], origin[1], origin[2]);
+        Point3 hi = lo;
+        for (size_t d = 0; d < 3; d++) {
+            hi[d] += (extent[d] > 0 ? extent[d] - 1 : 0) * spacing[d];
+        }
+        if (kind == "Jittered") {
+            return std::unique_ptr<SeedGenerator>(new LatticeSeeds(origin, extent, spacing, true, seed));
+        } else if (kind == "Random") {
+            return std::unique_ptr<SeedGenerator>(new RandomSeeds(lo, hi, count, seed));
+        } else if (kind == "Poisson disk") {
+            double radius = std::min(spacing[0], std::min(spacing[1], spacing[2]));
+            return std::unique_ptr<SeedGenerator>(new PoissonDiskSeeds(lo, hi, radius, count, seed));
+        } else if (kind == "Polyline") {
+            return std::unique_ptr<SeedGenerator>(new PolylineSeeds(parsePoints(polyline), count));
+        } else if (kind == "Plane") {
+            std::vector<Point3> n = parsePoints(normal);
+            return PlaneSeeds::fromNormal(lo, n.empty() ? Vector3(0.0, 0.0, 1.0) : n[0],
+                                          extent[0], extent[1], spacing[0], spacing[1]);
+        }
+        return std::unique_ptr<SeedGenerator>(new LatticeSeeds(origin, extent, spacing));
+    }
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <fantom/dataset.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace tasks
+{
+    using namespace fantom;
+
+    // line samples bucketed in cubes of cellSize, so all samples within
+    // cellSize of a point are in the 27 cubes around it. The samples are kept
+    // once, in the order they were inserted, the cubes only hold their indexes.
+    class SpatialHash
+    {
+    public:
+        SpatialHash(double cellSize)
+            : cellSize(cellSize)
+        {
+        }
+
+        void insert(const Point3 &p, size_t line) {
+            cells[key(cell(p[0]), cell(p[1]), cell(p[2]))].push_back(samples.size());
+            samples.push_back({p, line});
+        }
+
+        // true if a sample of a line other than skip is closer than distance,
+        // which must not be larger than the cell size
+        bool near(const Point3 &p, double distance, size_t skip = SIZE_MAX) const {
+            std::int64_t c[3] = {cell(p[0]), cell(p[1]), cell(p[2])};
+            double d2 = distance * distance;
+            for (std::int64_t i = c[0] - 1; i <= c[0] + 1; i++) {
+                for (std::int64_t j = c[1] - 1; j <= c[1] + 1; j++) {
+                    for (std::int64_t k = c[2] - 1; k <= c[2] + 1; k++) {
+                        auto it = cells.find(key(i, j, k));
+                        if (it == cells.end()) continue;
+                        for (size_t index : it->second) {
+                            const Sample &s = samples[index];
+                            if (s.line == skip) continue;
+                            Vector3 d = s.p - p;
+                            if (d[0] * d[0] + d[1] * d[1] + d[2] * d[2] < d2) return true;
+                        }
+                    }
+                }
+            }
+            return false;
+        }
+
+        size_t size() const {
+            return samples.size();
+        }
+
+        // the i-th sample inserted and the line it belongs to
+        const Point3 &point(size_t i) const {
+            return samples[i].p;
+        }
+
+        size_t line(size_t i) const {
+            return samples[i].line;
+        }
+
+    private:
+        struct Sample
+        {
+            Point3 p;
+            size_t line;
+        };
+
+        std::int64_t cell(double x) const {
+            return (std::int64_t) std::floor(x / cellSize);
+        }
+
+        static std::uint64_t key(std::int64_t i, std::int64_t j, std::int64_t k) {
+            std::uint64_t h = 1469598103934665603ull;
+            h = (h ^ (std::uint64_t) i) * 1099511628211ull;
+            h = (h ^ (std::uint64_t) j) * 1099511628211ull;
+            h = (h ^ (std::uint64_t) k) * 1099511628211ull;
+            return h;
+        }
+
+        double cellSize;
+        std::vector<Sample> samples;
+        std::unordered_map<std::uint64_t, std::vector<size_t>> cells;
+    };
+}
@@ -0,0 +1,256 @@
+#pragma once
+
+#include "meshExport.hpp"
+
+#include <fantom/dataset.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace tasks
+{
+    using namespace fantom;
+
+    // a point of a stream surface, the step-th point of a streamline
+    struct Sample
+    {
+        std::uint32_t line, step;
+    };
+
+    // frees the memory of a chunk once it is uploaded, clear would keep it
+    inline void releaseChunk(std::vector<PointF<3>> &points, std::vector<VectorF<3>> &normals,
+                             std::vector<std::uint16_t> &indexes) {
+        std::vector<PointF<3>>().swap(points);
+        std::vector<VectorF<3>>().swap(normals);
+        std::vector<std::uint16_t>().swap(indexes);
+    }
+
+    // Triangles of a stream surface over streamline samples. Every sample
+    // used by a triangle becomes exactly one vertex shared by all its
+    // triangles, so the mesh comes out indexed and computeNormals averages
+    // the normals of neighbouring triangles instead of giving facets.
+    class SurfaceMesh
+    {
+    public:
+        void add(Sample a, Sample b, Sample c) {
+            corners.push_back(a);
+            corners.push_back(b);
+            corners.push_back(c);
+            if (writer && corners.size() - streamed >= 3 * streamBlock) flushStream();
+        }
+
+        // appends the triangles of another mesh, e.g. one filled by another thread
+        void append(const SurfaceMesh &other) {
+            corners.insert(corners.end(), other.corners.begin(), other.corners.end());
+            if (writer && corners.size() - streamed >= 3 * streamBlock) flushStream();
+        }
+
+        void clear() {
+            corners.clear();
+            streamed = 0;
+        }
+
+        size_t triangles() const {
+            return dropped + corners.size() / 3;
+        }
+
+        // From now on the triangles also go to writer in blocks as they are
+        // added, each sample of lines becoming one vertex of the file. Without
+        // keep they are only counted afterwards, so there is nothing left to
+        // build or draw. Meshes of several threads may share the writer.
+        void streamTo(tasks::MeshWriter *writer, const std::vector<std::vector<Point<3>>> *lines, bool keep) {
+            this->writer = writer;
+            this->lines = lines;
+            this->keep = keep;
+        }
+
+        // Writes the triangles still held back and then the streamlines
+        // through the same vertices, and stops streaming.
+        void finishStream() {
+            if (!writer) return;
+            flushStream();
+            std::lock_guard<std::mutex> lock(writer->mutex());
+            std::vector<std::uint32_t> line;
+            for (size_t l = 0; l < lines->size(); l++) {
+                line.clear();
+                for (size_t j = 0; j < (*lines)[l].size(); j++) {
+                    line.push_back(fileVertex(Sample{(std::uint32_t) l, (std::uint32_t) j}));
+                }
+                writer->addLine(line.data(), line.size());
+            }
+            fileVertices.clear();
+            fileVertices.shrink_to_fit();
+            writer = nullptr;
+        }
+
+        // vertices in order of first use and three indexes per triangle
+        void build(const std::vector<std::vector<Point<3>>> &lines,
+                   std::vector<PointF<3>> &points,
+                   std::vector<unsigned int> &indexes) const {
+            std::vector<std::vector<unsigned int>> vertex(lines.size());
+            indexes.reserve(indexes.size() + corners.size());
+            for (const Sample &s : corners) {
+                std::vector<unsigned int> &ids = vertex[s.line];
+                if (ids.empty()) ids.assign(lines[s.line].size(), UINT32_MAX);
+                if (ids[s.step] == UINT32_MAX) {
+                    ids[s.step] = points.size();
+                    points.push_back(PointF<3>(lines[s.line][s.step]));
+                }
+                indexes.push_back(ids[s.step]);
+            }
+        }
+
+        // Like build, but in chunks of at most maxVertices vertices with 16 bit
+        // indexes, each handed to chunk(points, normals, indexes) and released
+        // right after, so only one chunk is held at a time. maxVertices should
+        // stay below 65536, 0xFFFF is the primitive restart index. Triangles
+        // keep their order, a sample used on both sides of a chunk border gets
+        // a vertex in both. The normals are summed over all triangles of a
+        // sample first, so the borders do not show in the shading.
+        template <typename Chunk>
+        void buildChunks(const std::vector<std::vector<Point<3>>> &lines, size_t maxVertices, Chunk chunk) const {
+            std::vector<std::vector<VectorF<3>>> normal(lines.size());
+            for (size_t k = 0; k + 2 < corners.size(); k += 3) {
+                const Point<3> &a = lines[corners[k].line][corners[k].step];
+                Vector3 u = lines[corners[k + 1].line][corners[k + 1].step] - a;
+                Vector3 v = lines[corners[k + 2].line][corners[k + 2].step] - a;
+                // the cross product, its length weights the triangle by area
+                VectorF<3> n(u[1] * v[2] - u[2] * v[1], u[2] * v[0] - u[0] * v[2], u[0] * v[1] - u[1] * v[0]);
+                for (size_t c = k; c < k + 3; c++) {
+                    std::vector<VectorF<3>> &sums = normal[corners[c].line];
+                    if (sums.empty()) sums.assign(lines[corners[c].line].size(), VectorF<3>(0.0f, 0.0f, 0.0f));
+                    sums[corners[c].step] += n;
+                }
+            }
+
+            std::vector<std::vector<unsigned int>> vertex(lines.size());
+            std::vector<Sample> used;
+            std::vector<PointF<3>> points;
+            std::vector<VectorF<3>> normals;
+            std::vector<std::uint16_t> indexes;
+            auto flush = [&]() {
+                if (indexes.empty()) return;
+                chunk(points, normals, indexes);
+                for (const Sample &s : used) {
+                    vertex[s.line][s.step] = UINT32_MAX;
+                }
+                used.clear();
+                releaseChunk(points, normals, indexes);
+            };
+            for (size_t k = 0; k + 2 < corners.size(); k += 3) {
+                size_t missing = 0;
+                for (size_t c = k; c < k + 3; c++) {
+                    std::vector<unsigned int> &ids = vertex[corners[c].line];
+                    if (ids.empty() || ids[corners[c].step] == UINT32_MAX) missing++;
+                }
+                if (points.size() + missing > maxVertices) flush();
+                for (size_t c = k; c < k + 3; c++) {
+                    const Sample &s = corners[c];
+                    std::vector<unsigned int> &ids = vertex[s.line];
+                    if (ids.empty()) ids.assign(lines[s.line].size(), UINT32_MAX);
+                    if (ids[s.step] == UINT32_MAX) {
+                        ids[s.step] = points.size();
+                        used.push_back(s);
+                        points.push_back(PointF<3>(lines[s.line][s.step]));
+                        VectorF<3> n = normal[s.line][s.step];
+                        float l = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+                        normals.push_back(l > 0.0f ? n / l : n);
+                    }
+                    indexes.push_back((std::uint16_t) ids[s.step]);
+                }
+            }
+            flush();
+        }
+
+    private:
+        static constexpr size_t streamBlock = 4096;
+
+        // the vertex of s in the file, written on first use
+        std::uint32_t fileVertex(Sample s) {
+            if (fileVertices.size() <= s.line) fileVertices.resize(lines->size());
+            std::vector<std::uint32_t> &ids = fileVertices[s.line];
+            if (ids.size() <= s.step) ids.resize((*lines)[s.line].size(), UINT32_MAX);
+            if (ids[s.step] == UINT32_MAX) ids[s.step] = writer->addVertex((*lines)[s.line][s.step]);
+            return ids[s.step];
+        }
+
+        void flushStream() {
+            {
+                std::lock_guard<std::mutex> lock(writer->mutex());
+                for (size_t k = streamed; k + 2 < corners.size(); k += 3) {
+                    std::uint32_t a = fileVertex(corners[k]), b = fileVertex(corners[k + 1]);
+                    writer->addTriangle(a, b, fileVertex(corners[k + 2]));
+                }
+            }
+            if (keep) {
+                streamed = corners.size();
+            } else {
+                dropped += corners.size() / 3;
+                corners.clear();
+            }
+        }
+
+        std::vector<Sample> corners;
+        tasks::MeshWriter *writer = nullptr;
+        const std::vector<std::vector<Point<3>>> *lines = nullptr;
+        bool keep = true;
+        size_t streamed = 0;   // corners already in the file
+        size_t dropped = 0;    // triangles streamed and not kept
+        std::vector<std::vector<std::uint32_t>> fileVertices;
+    };
+
+    // An indexed mesh in chunks as SurfaceMesh::buildChunks makes them,
+    // e.g. one that was decimated, with the normals over the whole mesh.
+    template <typename Chunk>
+    void chunkMesh(const std::vector<PointF<3>> &points, const std::vector<unsigned int> &indexes,
+                   size_t maxVertices, Chunk chunk) {
+        std::vector<VectorF<3>> normal(points.size(), VectorF<3>(0.0f, 0.0f, 0.0f));
+        for (size_t k = 0; k + 2 < indexes.size(); k += 3) {
+            VectorF<3> u = points[indexes[k + 1]] - points[indexes[k]];
+            VectorF<3> v = points[indexes[k + 2]] - points[indexes[k]];
+            VectorF<3> n(u[1] * v[2] - u[2] * v[1], u[2] * v[0] - u[0] * v[2], u[0] * v[1] - u[1] * v[0]);
+            for (size_t c = k; c < k + 3; c++) {
+                normal[indexes[c]] += n;
+            }
+        }
+        for (VectorF<3> &n : normal) {
+            float l = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            if (l > 0.0f) n = n / l;
+        }
+
+        std::vector<unsigned int> vertex(points.size(), UINT32_MAX);
+        std::vector<unsigned int> used;
+        std::vector<PointF<3>> chunkPoints;
+        std::vector<VectorF<3>> chunkNormals;
+        std::vector<std::uint16_t> chunkIndexes;
+        auto flush = [&]() {
+            if (chunkIndexes.empty()) return;
+            chunk(chunkPoints, chunkNormals, chunkIndexes);
+            for (unsigned int v : used) {
+                vertex[v] = UINT32_MAX;
+            }
+            used.clear();
+            releaseChunk(chunkPoints, chunkNormals, chunkIndexes);
+        };
+        for (size_t k = 0; k + 2 < indexes.size(); k += 3) {
+            size_t missing = 0;
+            for (size_t c = k; c < k + 3; c++) {
+                if (vertex[indexes[c]] == UINT32_MAX) missing++;
+            }
+            if (chunkPoints.size() + missing > maxVertices) flush();
+            for (size_t c = k; c < k + 3; c++) {
+                unsigned int v = indexes[c];
+                if (vertex[v] == UINT32_MAX) {
+                    vertex[v] = chunkPoints.size();
+                    used.push_back(v);
+                    chunkPoints.push_back(points[v]);
+                    chunkNormals.push_back(normal[v]);
+                }
+                chunkIndexes.push_back((std::uint16_t) vertex[v]);
+            }
+        }
+        flush();
+    }
+}
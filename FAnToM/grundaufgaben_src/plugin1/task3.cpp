@@ -63,15 +63,18 @@ namespace {
                 throw std::logic_error( "Wrong type of grid!" );
             }
             const ValueArray < Point3> & points = grid->points();
-            auto eval = field->makeEvaluator();
+            // values given at the points are read directly instead of locating
+            // every point in the grid again, cell values need the evaluator
+            const ValueArray < Scalar > & values = function->values();
+            bool onPoints = values.size() == points.size();
+            auto eval = onPoints ? nullptr : field->makeEvaluator();
 
             for(size_t i = 0; i < points.size(); i++) {
                 Point<3> point = points[i];
-                if (eval->reset(point)){
-                    auto value = eval->value();
-                    if (value[0] > threshold) {
-                        performanceObjectRenderer->addSphere(point, 0.1, color);
-                    }
+                if (!onPoints && !eval->reset(point)) continue;
+                auto value = onPoints ? values[i] : eval->value();
+                if (value[0] > threshold) {
+                    performanceObjectRenderer->addSphere(point, 0.1, color);
                 }
             }
             setGraphics("Kugels", performanceObjectRenderer->commit());
@@ -7,6 +7,15 @@
 #include <fantom-plugins/utils/Graphics/HelperFunctions.hpp>
 #include <fantom-plugins/utils/Graphics/ObjectRenderer.hpp>
 
+#include "evenSeeding.hpp"
+#include "fieldStorage.hpp"
+#include "importanceSeeding.hpp"
+#include "lineSimplification.hpp"
+#include "meshExport.hpp"
+#include "seedGenerators.hpp"
+#include "timeSeries.hpp"
+
+#include <functional>
 #include <vector>
 #include <math.h>
 
@@ -41,6 +50,28 @@ namespace
                 add<double>("dStep", "distance between steps", 0.05);
                 add<double>("adStep", "for calculating new step size", 0.02);
                 add<size_t>("nStep", "max number of steps", 100);
+                add<InputChoices>("Seeds", "how seeds are placed in the grid box", tasks::seedChoices(), "Uniform");
+                add<size_t>("Random seed", "for jittered, random and Poisson disk seeds", 0);
+                add<std::string>("Polyline", "seed curve as x y z points separated by commas, nx * ny * nz seeds", "-4 0.5 1, -4 6.5 5");
+                add<std::string>("Plane normal", "seed plane through the origin, nx * ny seeds spaced dx, dy", "1 0 0");
+                add<InputChoices>("Importance", "nx * ny * nz seeds at random nodes of the field, more where the feature is strong", tasks::featureChoices(), "Off");
+                add<Field<3, Scalar>>("Importance scalar", "feature for the Scalar importance", definedOn<Grid<3>>(Grid<3>::Points));
+                add<InputChoices>("Seeding", "where lines start", std::vector<std::string>{"Grid", "Evenly spaced"}, "Grid");
+                add<double>("dSep", "distance between evenly spaced lines", 0.5);
+                add<double>("dTest", "evenly spaced lines stop closer than dTest * dSep to another line", 0.5);
+                add<InputChoices>("Storage", "in-memory velocity representation", tasks::FieldStorage::choices(), "Double");
+                add<bool>("Compare storage", "log the error of the compressed velocities", false);
+                add<size_t>("Cache size", "recent velocity samples kept per sampler, 0 disables the cache", 0);
+                add<double>("Cache tolerance", "max difference in local cell coordinates for reusing a sample", 0.0);
+                add<bool>("Pathlines", "trace through the time series instead of the field", false);
+                add<DataObjectBundle>("Time series", "vector fields of consecutive time steps, e.g. from Load/VTK with a Time List");
+                add<std::string>("Time series files", "legacy VTK files of consecutive time steps on the grid of Field, separated by semicolons, wildcards allowed; read one at a time instead of the Time series", "");
+                add<bool>("Prefetch", "read the next time step in the background, which keeps a third one in memory", true);
+                add<double>("dTime", "time between two fields of the series", 1.0);
+                add<double>("Simplify", "max distance of dropped points to the drawn lines, 0 draws every step", 0.0);
+                add<std::string>("Export file", "binary file every line is written to as soon as it is traced, unsimplified, empty for none", "");
+                add<InputChoices>("Export format", "binary PLY or legacy VTK PolyData", tasks::exportChoices(), "PLY");
+                add<bool>("Export only", "keep no lines for drawing, only the file gets them", false);
                 addSeparator();
                 add<Color>("colorGrid", "The color of the grid", Color(1.0, 1.0, 1.0));
                 add<Color>("colorStream", "The color of the streamlines", Color(1.0, 0.0, 0.0));
@@ -66,10 +97,12 @@ namespace
         static void makeEuler(double &dStep, double &adStep, size_t nStep,
                           double &x, double &y, double &z, 
                           std::vector<Point<3>> &points, 
-                          std::shared_ptr<const Field<3, Vector3>> &field) {
+                          std::unique_ptr<tasks::VelocitySampler> &evaluator,
+                          const tasks::EvenSeeder *seeder = nullptr) {
             while (points.size() < nStep) {
                 Point3 p = {x, y, z};
-                auto evaluator = field->makeEvaluator();
+                // evenly spaced lines end where they come too close to another one
+                if (seeder && !seeder->accept(p)) return;
 
                 // check if in domain
                 if (evaluator->reset(p)) {
@@ -139,10 +172,11 @@ namespace
         static void makeRungeKutta(double &dStep, size_t nStep,
                                double &x, double &y, double &z, 
                                std::vector<Point<3>> &points, 
-                               std::shared_ptr<const Field<3, Vector3>> &field) {
+                               std::unique_ptr<tasks::VelocitySampler> &evaluator,
+                               const tasks::EvenSeeder *seeder = nullptr) {
             while (points.size() < nStep) {
-                auto evaluator = field->makeEvaluator();
                 Point3 p = {x, y, z};
+                if (seeder && !seeder->accept(p)) return;
 
                 double q1x, q1y, q1z;
                 double q2x, q2y, q2z;
@@ -209,6 +243,53 @@ namespace
             return;
         }
 
+        // fill vector with all stream points and make connections between them in vectorF vector
+        static void appendLine(const std::vector<Point<3>> &points,
+                               std::vector<PointF<3>> &pointFStream,
+                               std::vector<VectorF<3>> &connectStream) {
+            for (size_t i = 0; i < points.size(); i++) {
+                if (points.size() < 2) {
+                    break;
+                }
+                pointFStream.push_back(PointF<3>(points[i][0], points[i][1], points[i][2]));
+                if (i != 0 && i != points.size() - 1) {
+                    connectStream.push_back(VectorF<3>(points[i]));
+                }
+                connectStream.push_back(VectorF<3>(points[i]));
+            }
+        }
+
+        // all particles advance together, so only the two fields around the
+        // current time have to be resident. The step is shortened until a whole
+        // number of steps fits between two fields.
+        static void makePathlines(tasks::SliceStream &stream, std::string method,
+                                  double dStep, double dTime, size_t nStep,
+                                  tasks::SeedGenerator &seeds,
+                                  std::vector<std::vector<Point<3>>> &lines) {
+            size_t perSlice = std::max<size_t>(1, (size_t) std::ceil(dTime / dStep));
+            double h = dTime / perSlice;
+            auto sampler = stream.makeSampler();
+            std::vector<size_t> alive;
+            for (const Point3 &p : tasks::seeds(seeds)) {
+                alive.push_back(lines.size());
+                lines.push_back({p});
+            }
+            for (size_t j = 0; j + 1 < nStep && !alive.empty(); j++) {
+                if (!stream.load(j / perSlice)) break;
+                double t0 = double(j % perSlice) / perSlice;
+                double t1 = double(j % perSlice + 1) / perSlice;
+                size_t n = 0;
+                for (size_t k = 0; k < alive.size(); k++) {
+                    std::vector<Point<3>> &line = lines[alive[k]];
+                    Point<3> next;
+                    if (!tasks::pathStep(*sampler, line.back(), t0, t1, h, method == "Runge-Kutta", next)) continue;
+                    line.push_back(next);
+                    alive[n++] = alive[k];
+                }
+                alive.resize(n);
+            }
+        }
+
         static std::shared_ptr<graphics::Drawable> drawLines(std::vector<PointF<3>> pointsFList,std::vector<VectorF<3>> vertices, Color color)
         {
             auto const &system = graphics::GraphicsSystem::instance(); // The GraphicsSystem is needed to create Drawables, which represent the to be rendererd objects.
@@ -233,7 +314,7 @@ namespace
 
         virtual void execute(const Algorithm::Options &options, const volatile bool & /*abortFlag*/) override
         {
-            // make a structured grid to start lines at edges
+            // box of the seeds, lines start at its grid points unless another seeding is chosen
             double origin[] = { options.get< double >("ox"),
                                 options.get< double >("oy"),
                                 options.get< double >("oz")};
@@ -243,32 +324,25 @@ namespace
             double spacing[] = {options.get< double >("dx"), 
                                 options.get< double >("dy"), 
                                 options.get< double >("dz")};
-            std::shared_ptr< const Grid< 3 > > grid = DomainFactory::makeUniformGrid( extent, origin, spacing );
-            const ValueArray< Point3 >& pointsGrid = grid->points();
+            // seeds are generated on the fly, the grid lines only outline where they come from
+            unsigned int randomSeed = (unsigned int) options.get<size_t>("Random seed");
+            std::function<std::unique_ptr<tasks::SeedGenerator>()> makeSeeds = [&]() {
+                return tasks::makeSeedGenerator(options.get<std::string>("Seeds"), origin, extent, spacing,
+                                                randomSeed,
+                                                options.get<std::string>("Polyline"),
+                                                options.get<std::string>("Plane normal"));
+            };
+            std::unique_ptr<tasks::SeedGenerator> generator;
             std::vector<VectorF<3>> connectGrid;
             std::vector<PointF<3>> pointFGrid;
-            
-            // for cell in grid
-            for (size_t i = 0; i < grid->numCells(); i++) {
-                Cell cell = grid->cell( i );
-                std::vector<size_t> connections = {0,1, 1,2, 2,3, 3,0,
-                                                   7,6, 6,5, 5,4, 4,7,
-                                                   0,7, 1,6, 2,5, 3,4 };
-
-                // std::vector<size_t> connections = { 0,1,1,2,2,3,3,0,0,7,7,6,6,1,6,5,5,2,5,4,4,3,4,7 };
-
-                // make points array to pointf vector
-                for (size_t j = 0; j < 8; j++) {
-                    Point3 p = pointsGrid[cell.index( j )];
+            auto outlineSeeds = [&]() {
+                std::vector<Point3> outline;
+                generator->outline(outline);
+                for (const Point3 &p : outline) {
                     pointFGrid.push_back(PointF<3>(p[0], p[1], p[2]));
-                }
-
-                // make connections of grid to connect vector
-                for (size_t k = 0; k < connections.size(); k++) {
-                    Point3 p = pointsGrid[cell.index( connections[k] )];
                     connectGrid.push_back(VectorF<3>(p));
                 }
-            }
+            };
 
             std::string method = options.get<std::string>("Method");
             double dStep = options.get<double>("dStep");
@@ -276,6 +350,66 @@ namespace
             size_t nStep = options.get<size_t>("nStep");
             Color colorGrid = options.get<Color>("colorGrid");
             Color colorStream = options.get<Color>("colorStream");
+            double tolerance = options.get<double>("Simplify");
+
+            std::unique_ptr<tasks::MeshWriter> writer;
+            bool exportOnly = false;
+            if (!options.get<std::string>("Export file").empty()) {
+                writer.reset(new tasks::MeshWriter(options.get<std::string>("Export file"), options.get<std::string>("Export format")));
+                if (!writer->good()) {
+                    debugLog() << "cannot write " << options.get<std::string>("Export file") << std::endl;
+                    writer.reset();
+                } else {
+                    exportOnly = options.get<bool>("Export only");
+                }
+            }
+
+            if (options.get<bool>("Pathlines")) {
+                std::string error;
+                std::unique_ptr<tasks::SliceStream> stream = tasks::openSeries(
+                    options.get<std::string>("Time series files"), options.get<Function<Vector3>>("Field"),
+                    options.get<DataObjectBundle>("Time series"), options.get<std::string>("Storage"),
+                    options.get<bool>("Prefetch"), error);
+                if (!stream) {
+                    debugLog() << "Pathlines: " << error << "." << std::endl;
+                    return;
+                }
+                if (options.get<std::string>("Importance") != "Off") {
+                    debugLog() << "importance seeding needs the steady field, pathlines use the seeds of the box" << std::endl;
+                }
+                generator = makeSeeds();
+                outlineSeeds();
+                std::vector<std::vector<Point<3>>> lines;
+                try {
+                    makePathlines(*stream, method, dStep, options.get<double>("dTime"), nStep, *generator, lines);
+                } catch (const std::runtime_error &e) {
+                    // a time series file that cannot be read
+                    debugLog() << "Pathlines: " << e.what() << std::endl;
+                    return;
+                }
+                debugLog() << stream->describe() << std::endl;
+                // the pathlines grow together, so they are written once complete
+                if (writer) {
+                    for (const auto &points : lines) {
+                        writer->addLine(points);
+                    }
+                    writer->close();
+                    debugLog() << writer->describe() << std::endl;
+                    if (exportOnly) lines.clear();
+                }
+                if (tolerance > 0.0) {
+                    debugLog() << tasks::simplifyLines(lines, tolerance) << std::endl;
+                }
+
+                std::vector<VectorF<3>> connectStream;
+                std::vector<PointF<3>> pointFStream;
+                for (const auto &points : lines) {
+                    appendLine(points, pointFStream, connectStream);
+                }
+                setGraphics("grid", drawLines(pointFGrid, connectGrid, colorGrid));
+                setGraphics("streams", drawLines(pointFStream, connectStream, colorStream));
+                return;
+            }
 
             std::shared_ptr<const Field<3, Vector3>> field = options.get<Field<3, Vector3>>("Field");
             std::shared_ptr<const Function<Vector3>> function = options.get<Function<Vector3>>("Field");
@@ -293,38 +427,89 @@ namespace
                 throw std::logic_error("Wrong type of grid!");
             }
 
-            // prepare for the streams
+            tasks::FieldStorage storage(field, function,
+                                        options.get<std::string>("Storage"));
+            debugLog() << storage.describe() << std::endl;
+            if (options.get<bool>("Compare storage") && storage.ownInterpolation()) {
+                debugLog() << storage.describe(storage.compare()) << std::endl;
+            }
+            size_t cacheSize = options.get<size_t>("Cache size");
+            if (!storage.useCache(cacheSize, options.get<double>("Cache tolerance"))) {
+                debugLog() << "sample cache needs a lattice or compressed storage, tracing without it" << std::endl;
+            }
+            auto evaluator = storage.makeSampler();
+
+            // importance seeding picks nodes of the field's grid instead of points in the box
+            std::string feature = options.get<std::string>("Importance");
+            if (feature != "Off") {
+                std::shared_ptr<const Field<3, Scalar>> scalar = options.get<Field<3, Scalar>>("Importance scalar");
+                auto nodeAt = [functionDomainGrid](size_t i) { return functionDomainGrid->points()[i]; };
+                auto table = std::make_shared<const tasks::ImportanceTable>(functionDomainGrid->numPoints(), nodeAt, [&]() {
+                    return tasks::FeatureProbe(feature, storage.makeSampler(), scalar ? scalar->makeEvaluator() : nullptr, dStep);
+                });
+                debugLog() << table->describe() << std::endl;
+                size_t count = extent[0] * extent[1] * extent[2];
+                double jitter = tasks::nodeSpacing(*table);
+                makeSeeds = [=]() {
+                    return std::unique_ptr<tasks::SeedGenerator>(
+                        new tasks::ImportanceSeeds<decltype(nodeAt)>(table, nodeAt, count, jitter, randomSeed));
+                };
+            }
+            generator = makeSeeds();
+            outlineSeeds();
+
+            // evenly spaced seeding starts at the grid points and picks the rest itself
+            std::unique_ptr<tasks::EvenSeeder> seeder;
+            if (options.get<std::string>("Seeding") == "Evenly spaced") {
+                double dSep = options.get<double>("dSep");
+                seeder.reset(new tasks::EvenSeeder(dSep, options.get<double>("dTest") * dSep, makeSeeds()));
+            }
+
+            // every seed makes a stream, kept as a line only if it is simplified at the end
+            std::vector<std::vector<Point<3>>> lines;
             std::vector<VectorF<3>> connectStream;
             std::vector<PointF<3>> pointFStream;
-
-            // all points of the grid make a stream
-            for (size_t i = 0; i < functionDomainGrid->numPoints(); i++) {
+            while (true) {
                 // get starting coords
-                Point3 p = grid->points()[i];
+                Point3 p;
+                if (!seeder ? !generator->next(p) : !seeder->next(*evaluator, p)) break;
                 double x = p[0], y = p[1], z = p[2];
                 std::vector<Point<3>> points;
 
                 if (method == "Euler") {
-                    makeEuler(dStep, adStep, nStep, x, y, z, points, field);
+                    makeEuler(dStep, adStep, nStep, x, y, z, points, evaluator, seeder.get());
                 }
                 else if (method == "Runge-Kutta") {
-                    makeRungeKutta(dStep, nStep, x, y, z, points, field);
+                    makeRungeKutta(dStep, nStep, x, y, z, points, evaluator, seeder.get());
                 }
                 else {
                     std::cout << "Something went wrong" << std::endl;
                 }
 
-                // fill vector with all stream points and make connections between them in vectorF vector
-                for (size_t i = 0; i < points.size(); i++) {
-                    if (points.size() < 2) {
-                        break;
-                    }
-                    pointFStream.push_back(PointF<3>(points[i][0], points[i][1], points[i][2]));
-                    if (i != 0 && i != points.size() - 1) {
-                        connectStream.push_back(VectorF<3>(points[i]));
-                    }
-                    connectStream.push_back(VectorF<3>(points[i]));
-                }
+                if (seeder) seeder->addLine(points);
+                if (writer) writer->addLine(points);
+                if (exportOnly) continue;
+                if (tolerance > 0.0) lines.push_back(std::move(points));
+                else appendLine(points, pointFStream, connectStream);
+            }
+            if (seeder) {
+                debugLog() << seeder->describe() << std::endl;
+            }
+            if (writer) {
+                writer->close();
+                debugLog() << writer->describe() << std::endl;
+            }
+
+            if (cacheSize && storage.ownInterpolation()) {
+                debugLog() << storage.describeCache() << std::endl;
+            }
+
+            // the drawables only get the points needed to stay within the tolerance
+            if (tolerance > 0.0) {
+                debugLog() << tasks::simplifyLines(lines, tolerance) << std::endl;
+            }
+            for (const auto &points : lines) {
+                appendLine(points, pointFStream, connectStream);
             }
 
             // making the visualization
@@ -0,0 +1,322 @@
+#pragma once
+
+#include "cellAdjacency.hpp"
+#include "cellLocator.hpp"
+#include "fieldStorage.hpp"
+#include "legacyVtk.hpp"
+#include "velocitySampler.hpp"
+
+#include <fantom/dataset.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace tasks
+{
+    using namespace fantom;
+
+    // one time step of the series in the chosen storage
+    struct Slice
+    {
+        std::shared_ptr<const Field<3, Vector3>> field;
+        std::shared_ptr<const Function<Vector3>> function;
+        std::shared_ptr<const std::vector<Vector3>> values;
+        std::shared_ptr<const HalfNodes> half;
+        std::shared_ptr<const QuantizedNodes> quantized;
+
+        Vector3 get(size_t i) const {
+            if (half) return half->get(i);
+            if (quantized) return quantized->get(i);
+            if (values) return (*values)[i];
+            return function->values()[i];
+        }
+
+        // memory of its own, slices of a bundle only point into it
+        size_t bytes() const {
+            if (half) return half->bytes();
+            if (quantized) return quantized->bytes();
+            if (values) return values->size() * sizeof(Vector3);
+            return 0;
+        }
+    };
+
+    // A time series of vector fields on one grid. Read from legacy VTK files,
+    // a slice is only in memory while the tracers use it: the two bracketing
+    // the current time, plus the one after them while it is built on a
+    // background thread, however long the series is. Without the prefetch it is
+    // read when the window moves and at most two are resident. A bundle, e.g.
+    // from Load/VTK with a Time List, is already loaded as a whole by FAnToM;
+    // the stream then only holds the compressed copies. Slices have to be
+    // visited in increasing order.
+    class SliceStream
+    {
+    public:
+        SliceStream(std::shared_ptr<const DataObjectBundle> bundle,
+                    const std::string &storage,
+                    bool prefetch = true)
+            : bundle(std::move(bundle)), prefetch(prefetch), current(SIZE_MAX)
+        {
+            for (size_t i = 0; i < this->bundle->getSize(); i++) {
+                if (!std::dynamic_pointer_cast<const Field<3, Vector3>>(this->bundle->getContent(i))) {
+                    throw std::logic_error("Time series must only contain 3D vector fields!");
+                }
+            }
+            setType(storage);
+            if (size() < 2) return;
+
+            // all slices share the grid of the first one, so it is located once
+            auto function = std::dynamic_pointer_cast<const Function<Vector3>>(this->bundle->getContent(0));
+            if (function) grid = std::dynamic_pointer_cast<const Grid<3>>(function->domain());
+            if (!grid) {
+                type = FieldStorage::Type::Double;
+                return;
+            }
+            // uncompressed slices off a lattice are left to the evaluators of the
+            // bundle, which locate faster than the bvh
+            locate(type != FieldStorage::Type::Double);
+        }
+
+        // the files are read one at a time, their point vectors on the given grid
+        SliceStream(std::vector<std::string> files,
+                    std::shared_ptr<const Grid<3>> grid,
+                    const std::string &storage,
+                    bool prefetch = true)
+            : files(std::move(files)), grid(std::move(grid)), prefetch(prefetch), current(SIZE_MAX)
+        {
+            setType(storage);
+            // there are no fields to evaluate, so the samplers always interpolate themselves
+            locate(true);
+        }
+
+        ~SliceStream() {
+            if (next.valid()) next.wait();
+        }
+
+        size_t size() const {
+            return files.empty() ? bundle->getSize() : files.size();
+        }
+
+        // makes slices k and k + 1 resident and, with the prefetch, starts
+        // building k + 2. False past the end of the series.
+        bool load(size_t k) {
+            if (k + 1 >= size()) return false;
+            if (k == current) return true;
+            if (current != SIZE_MAX && k == current + 1) {
+                // the first slice is dropped before the next one is taken or read
+                window[0] = std::move(window[1]);
+                auto start = std::chrono::steady_clock::now();
+                window[1] = next.valid() ? next.get() : makeSlice(k + 1);
+                waited += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            } else {
+                // a prefetch for another window is of no use
+                if (next.valid()) next.wait();
+                next = std::future<std::shared_ptr<const Slice>>();
+                window[0].reset();
+                window[1].reset();
+                window[0] = makeSlice(k);
+                window[1] = makeSlice(k + 1);
+            }
+            current = k;
+            generation++;
+            loaded++;
+            if (prefetch && k + 2 < size()) {
+                next = std::async(std::launch::async, [this, k]() { return makeSlice(k + 2); });
+            }
+            peak = std::max(peak, (size_t) 2 + next.valid());
+            return true;
+        }
+
+        std::string describe() const {
+            std::ostringstream s;
+            s << "time series: " << size() << " slices" << (files.empty() ? " in the input bundle" : " read from files")
+              << ", " << loaded << " windows loaded, " << waited * 1000 << " ms waiting for "
+              << (prefetch ? "the prefetch" : "the slices");
+            if (window[0] && window[0]->bytes()) {
+                s << ", " << window[0]->bytes() / 1024 << " KiB per slice, at most " << peak << " resident";
+            }
+            if (!locatorLog.empty()) s << "\n" << locatorLog;
+            return s.str();
+        }
+
+        // blends the two resident slices, time is the fraction of the way from
+        // the first to the second one. Not safe against a concurrent load().
+        class Sampler : public VelocitySampler
+        {
+        public:
+            Sampler(const SliceStream &stream)
+                : stream(stream), last(SIZE_MAX), generation(0), time(0.0)
+            {
+            }
+
+            void setTime(double t) {
+                time = t;
+            }
+
+            bool reset(const Point<3> &p) override {
+                const Slice &s0 = *stream.window[0];
+                const Slice &s1 = *stream.window[1];
+                CellLocation loc;
+                if (stream.onLattice) {
+                    if (!stream.lattice.locate(p, loc)) return false;
+                } else if (stream.cellLocator) {
+                    bool found = last != SIZE_MAX && stream.adjacency->walk(*stream.grid, p, last, loc);
+                    if (!found && !stream.cellLocator->locate(*stream.grid, p, loc)) return false;
+                    last = loc.cell;
+                } else {
+                    // evaluators belong to one field, renew them whenever the window moved
+                    if (generation != stream.generation) {
+                        e0 = s0.field->makeEvaluator();
+                        e1 = s1.field->makeEvaluator();
+                        generation = stream.generation;
+                    }
+                    if (!e0->reset(p) || !e1->reset(p)) return false;
+                    v = (1.0 - time) * e0->value() + time * e1->value();
+                    return true;
+                }
+                Vector3 v0 = loc.weights[0] * s0.get(loc.nodes[0]);
+                Vector3 v1 = loc.weights[0] * s1.get(loc.nodes[0]);
+                for (size_t j = 1; j < loc.count; j++) {
+                    v0 += loc.weights[j] * s0.get(loc.nodes[j]);
+                    v1 += loc.weights[j] * s1.get(loc.nodes[j]);
+                }
+                v = (1.0 - time) * v0 + time * v1;
+                return true;
+            }
+
+            Vector3 value() const override {
+                return v;
+            }
+
+        private:
+            const SliceStream &stream;
+            size_t last;
+            size_t generation;
+            double time;
+            std::unique_ptr<FieldEvaluator<3UL, Vector3>> e0;
+            std::unique_ptr<FieldEvaluator<3UL, Vector3>> e1;
+            Vector3 v;
+        };
+
+        std::unique_ptr<Sampler> makeSampler() const {
+            return std::unique_ptr<Sampler>(new Sampler(*this));
+        }
+
+    private:
+        void setType(const std::string &storage) {
+            if (storage == "Half") type = FieldStorage::Type::Half;
+            else if (storage == "Quantized") type = FieldStorage::Type::Quantized;
+            else type = FieldStorage::Type::Double;
+        }
+
+        void locate(bool bvh) {
+            onLattice = Lattice::detect(*grid, lattice);
+            if (!onLattice && bvh) {
+                cellLocator = CellLocator::forGrid(grid, &locatorLog);
+                adjacency = CellAdjacency::forGrid(grid);
+            }
+        }
+
+        std::shared_ptr<const Slice> makeSlice(size_t k) const {
+            std::shared_ptr<Slice> slice = std::make_shared<Slice>();
+            if (!files.empty()) {
+                std::shared_ptr<std::vector<Vector3>> values = std::make_shared<std::vector<Vector3>>();
+                LegacyVtkVectors::read(files[k], grid->numPoints(), *values);
+                if (type == FieldStorage::Type::Half) {
+                    slice->half = std::make_shared<HalfNodes>(*values);
+                } else if (type == FieldStorage::Type::Quantized) {
+                    slice->quantized = std::make_shared<QuantizedNodes>(*values);
+                } else {
+                    slice->values = values;
+                }
+                return slice;
+            }
+            slice->field = std::dynamic_pointer_cast<const Field<3, Vector3>>(bundle->getContent(k));
+            slice->function = std::dynamic_pointer_cast<const Function<Vector3>>(bundle->getContent(k));
+            if (!onLattice && !cellLocator) return slice;
+            if (!slice->function || slice->function->values().size() != grid->numPoints()) {
+                throw std::logic_error("Wrong type of grid!");
+            }
+            if (type == FieldStorage::Type::Half) {
+                slice->half = std::make_shared<HalfNodes>(slice->function->values());
+            } else if (type == FieldStorage::Type::Quantized) {
+                slice->quantized = std::make_shared<QuantizedNodes>(slice->function->values());
+            }
+            return slice;
+        }
+
+        std::shared_ptr<const DataObjectBundle> bundle;
+        std::vector<std::string> files;
+        FieldStorage::Type type;
+        std::shared_ptr<const Grid<3>> grid;
+        bool prefetch;
+        bool onLattice = false;
+        Lattice lattice;
+        std::shared_ptr<const CellLocator> cellLocator;
+        std::shared_ptr<const CellAdjacency> adjacency;
+        std::string locatorLog;
+        std::shared_ptr<const Slice> window[2];
+        std::future<std::shared_ptr<const Slice>> next;
+        size_t current;
+        size_t generation = 0;
+        size_t loaded = 0;
+        size_t peak = 0;
+        double waited = 0.0;
+    };
+
+    // The series a pathline task traces through: the files if any are given,
+    // on the grid of the steady field, otherwise the bundle. Null with the
+    // reason in error if there are not two slices to trace between.
+    inline std::unique_ptr<SliceStream> openSeries(const std::string &fileList,
+                                                   std::shared_ptr<const Function<Vector3>> function,
+                                                   std::shared_ptr<const DataObjectBundle> bundle,
+                                                   const std::string &storage,
+                                                   bool prefetch,
+                                                   std::string &error) {
+        if (!fileList.empty()) {
+            std::vector<std::string> files = expandFileList(fileList);
+            std::shared_ptr<const Grid<3>> grid = function
+                ? std::dynamic_pointer_cast<const Grid<3>>(function->domain()) : nullptr;
+            if (!grid) error = "time series files need the Field for their grid";
+            else if (files.size() < 2) error = "time series files need at least two files";
+            else return std::unique_ptr<SliceStream>(new SliceStream(files, grid, storage, prefetch));
+            return nullptr;
+        }
+        if (!bundle || bundle->getSize() < 2) {
+            error = "a time series of at least two fields is needed";
+            return nullptr;
+        }
+        return std::unique_ptr<SliceStream>(new SliceStream(bundle, storage, prefetch));
+    }
+
+    // one step of a pathline from time t0 to t1 (as fractions between the
+    // resident slices) with step size h. Runge-Kutta samples the stages at their
+    // own times, Euler only uses the velocity at the start.
+    inline bool pathStep(SliceStream::Sampler &sampler, const Point3 &p, double t0, double t1, double h,
+                         bool rungeKutta, Point3 &next) {
+        sampler.setTime(t0);
+        if (!sampler.reset(p)) return false;
+        Vector3 k1 = sampler.value();
+        if (k1[0] == 0 && k1[1] == 0 && k1[2] == 0) return false;
+        if (!rungeKutta) {
+            next = p + h * k1;
+            return true;
+        }
+        double tm = 0.5 * (t0 + t1);
+        sampler.setTime(tm);
+        if (!sampler.reset(p + 0.5 * h * k1)) return false;
+        Vector3 k2 = sampler.value();
+        if (!sampler.reset(p + 0.5 * h * k2)) return false;
+        Vector3 k3 = sampler.value();
+        sampler.setTime(t1);
+        if (!sampler.reset(p + h * k3)) return false;
+        Vector3 k4 = sampler.value();
+        next = p + h / 6.0 * (k1 + 2.0 * k2 + 2.0 * k3 + k4);
+        return true;
+    }
+}
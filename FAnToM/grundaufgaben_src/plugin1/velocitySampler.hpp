@@ -0,0 +1,108 @@
+#pragma once
+
+#include <fantom/dataset.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace tasks
+{
+    using namespace fantom;
+
+    // Everything the tracers sample velocities from. It mirrors reset()/value()
+    // of FieldEvaluator, so the step functions do not care where the data lives.
+    class VelocitySampler
+    {
+    public:
+        virtual ~VelocitySampler() = default;
+        virtual bool reset(const Point<3> &p) = 0;
+        virtual Vector3 value() const = 0;
+    };
+
+    // default sampler: just forwards to the evaluator of the input field
+    class FieldSampler : public VelocitySampler
+    {
+    public:
+        FieldSampler(const Field<3, Vector3> &field)
+            : evaluator(field.makeEvaluator())
+        {
+        }
+
+        bool reset(const Point<3> &p) override {
+            return evaluator->reset(p);
+        }
+
+        Vector3 value() const override {
+            return evaluator->value();
+        }
+
+    private:
+        std::unique_ptr<FieldEvaluator<3UL, Vector3>> evaluator;
+    };
+
+    struct CacheCounters
+    {
+        size_t lookups = 0;
+        size_t hits = 0;
+    };
+
+    // small direct mapped memory of recent samples, keyed by cell and local
+    // coordinates inside the cell. A sample is reused if every local coordinate
+    // differs by at most tolerance, with 0 only exact repeats are reused.
+    class SampleCache
+    {
+    public:
+        SampleCache(size_t size, double tolerance, std::shared_ptr<CacheCounters> counters)
+            : tolerance(tolerance), bucket(std::max(tolerance, 1.0 / 4096)), counters(std::move(counters))
+        {
+            size_t n = 1;
+            while (n < size) n *= 2;
+            entries.resize(n);
+        }
+
+        bool find(size_t cell, const double local[3], Vector3 &v) {
+            counters->lookups++;
+            const Entry &e = entries[slot(cell, local)];
+            if (e.cell != cell
+                || std::abs(e.local[0] - local[0]) > tolerance
+                || std::abs(e.local[1] - local[1]) > tolerance
+                || std::abs(e.local[2] - local[2]) > tolerance) return false;
+            counters->hits++;
+            v = e.v;
+            return true;
+        }
+
+        void store(size_t cell, const double local[3], const Vector3 &v) {
+            Entry &e = entries[slot(cell, local)];
+            e.cell = cell;
+            e.local[0] = local[0];
+            e.local[1] = local[1];
+            e.local[2] = local[2];
+            e.v = v;
+        }
+
+    private:
+        struct Entry
+        {
+            size_t cell = SIZE_MAX;
+            double local[3];
+            Vector3 v;
+        };
+
+        size_t slot(size_t cell, const double local[3]) const {
+            std::uint64_t h = cell * 0x9e3779b97f4a7c15ull;
+            for (size_t d = 0; d < 3; d++) {
+                h = (h ^ (std::uint64_t) (std::int64_t) std::floor(local[d] / bucket)) * 0x100000001b3ull;
+            }
+            return (h ^ (h >> 29)) & (entries.size() - 1);
+        }
+
+        double tolerance;
+        double bucket;
+        std::shared_ptr<CacheCounters> counters;
+        std::vector<Entry> entries;
+    };
+}